@@ -14,8 +14,12 @@
 #include <unistd.h>
 #include <ctime>
 #include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
 
 #include "FGFSTelnetSocket.h"
+#include "EventLoop.h"
+#include "OutputSink.h"
 #include "CDUKeys.h"
 
 #include <hidapi/hidapi.h>
@@ -32,7 +36,20 @@ const int keepAliveInterval = 10;
 
 hid_device* hidComplexDevice = nullptr;
 hid_device* hidPlainDevice = nullptr;
-bool keepRunning = true;
+
+// on Linux we read key reports straight from the hidraw node, so the event
+// loop can wait on it; elsewhere hidapi gives us no descriptor to wait on.
+int hidComplexFd = -1;
+const int hidPollIntervalMsec = 10;
+const int outputTickMsec = 10;
+
+EventLoop eventLoop;
+EventLoop::TimerId backoffBlinkTimer = -1;
+bool backoffBlinkPhase = false;
+int registeredSocketFd = -1;
+int reconnectBackoff = defaultReconnectBackoff;
+std::string host = fgfsHost;
+int port = fgfsPort;
 
 FGFSTelnetSocket telnetSocket;
 std::vector<bool> keyState;
@@ -53,6 +70,8 @@ std::vector<std::string> lampNames = {
     
 bool writeBytes(hid_device* dev, const std::vector<uint8_t>& bytes);
 void readCDU();
+void pollCDU();
+void checkConnection();
 void exitCleanup();
 
 bool stringAsBool(const std::string& s)
@@ -65,14 +84,54 @@ bool stringAsBool(const std::string& s)
 
 void interruptHandler(int)
 {
-    keepRunning = false;
+    eventLoop.quit();
 }
 
+// one lamp report per lamp that changed since the last output tick, so a
+// lamp flipped several times within a tick costs one report
+class HIDLampSink : public OutputSink
+{
+public:
+    std::string name() const override
+    {
+        return "CDU HID";
+    }
+
+    void setLamp(unsigned int channel, bool on) override
+    {
+        _wanted.at(channel) = on;
+    }
+
+    unsigned int commit() override
+    {
+        unsigned int reports = 0;
+        for (size_t l = 0; l < _wanted.size(); ++l) {
+            if (_known && (_wanted[l] == _sent[l])) {
+                continue;
+            }
+
+            writeBytes(hidComplexDevice,
+                {0x15, static_cast<uint8_t>(l), static_cast<uint8_t>(_wanted[l] ? 0xff : 0),
+                0, 0, 0, 0, 0});
+            _sent[l] = _wanted[l];
+            ++reports;
+        }
+
+        _known = true;
+        return reports;
+    }
+private:
+    std::vector<bool> _wanted = std::vector<bool>(static_cast<size_t>(Lamp::Count), false);
+    std::vector<bool> _sent = _wanted;
+    bool _known = false; // nothing sent yet
+};
+
+HIDLampSink cduLamps;
+OutputSet outputs;
+
 void setLamp(Lamp l, bool on)
 {
-    writeBytes(hidComplexDevice, 
-        {0x15, static_cast<uint8_t>(l), static_cast<uint8_t>(on ? 0xff : 0), 
-        0, 0, 0, 0, 0});
+    cduLamps.setLamp(static_cast<unsigned int>(l), on);
 }
 
 void enableBacklight()
@@ -113,20 +172,32 @@ void queryProperty(uint8_t propId, uint8_t bytes)
     writeBytes(hidComplexDevice, {0x3, bytes, 0xA9, 0, 0, 0, 0, 0});
 }
 
-void idleForTime(int timeSec)
+// blink while waiting to reconnect, so it's obvious we're not connected
+void startBackoffBlink()
 {
-    time_t endTime = time(nullptr) + timeSec;
+    if (backoffBlinkTimer >= 0) {
+        return;
+    }
+
     setLamp(Lamp::Fail, true);
-    while (time(nullptr) < endTime) {
-        readCDU();
-        ::usleep(400 * 1000);
-        setLamp(Lamp::Message, true);
-        setBacklight(2);
-        readCDU();
-        ::usleep(400 * 1000);
-        setLamp(Lamp::Message, false);
-        setBacklight(8);
+    backoffBlinkPhase = false;
+    backoffBlinkTimer = eventLoop.addTimer(std::chrono::milliseconds(400), [](uint64_t) {
+        backoffBlinkPhase = !backoffBlinkPhase;
+        setLamp(Lamp::Message, backoffBlinkPhase);
+        setBacklight(backoffBlinkPhase ? 2 : 8);
+    });
+}
+
+void stopBackoffBlink()
+{
+    if (backoffBlinkTimer < 0) {
+        return;
     }
+
+    eventLoop.cancelTimer(backoffBlinkTimer);
+    backoffBlinkTimer = -1;
+    setLamp(Lamp::Message, false);
+    setBacklight(8);
 }
 
 void pollHandler(const std::string& message)
@@ -211,6 +282,11 @@ void initCDU()
         wstring wName(dev->product_string);
         if (wName == L"Complex Interfaces") {
             hidComplexDevice = hid_open_path(dev->path);
+#if defined(__linux__)
+            // hidapi's Linux backend is a thin wrapper on the hidraw node,
+            // so a second non-blocking descriptor sees the same reports
+            hidComplexFd = ::open(dev->path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+#endif
         } else if (wName == L"Plain I/O") {
             hidPlainDevice = hid_open_path(dev->path);
         } else if (wName == L"interfaceIT Controller v2") {
@@ -261,6 +337,11 @@ void shutdownCDU()
         hid_close(hidPlainDevice);
         hidPlainDevice = nullptr;
     }
+
+    if (hidComplexFd >= 0) {
+        ::close(hidComplexFd);
+        hidComplexFd = -1;
+    }
     
     hid_exit();
 }
@@ -342,7 +423,27 @@ void readCDU()
     // in practice, this means look for key-presses
     while (true) {
         uint8_t report[9];
-        int len = hid_read_timeout(hidComplexDevice, report, sizeof(report), 0);
+        int len;
+        if (hidComplexFd >= 0) {
+            len = ::read(hidComplexFd, report, sizeof(report));
+            if ((len < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+                return; // no report to read
+            }
+
+            // after an unplug the fd stays readable with an error, so it
+            // would wake the loop forever: drop it and go back to polling
+            if (len < 0) {
+                perror("error reading from CDU hidraw device");
+                eventLoop.removeFd(hidComplexFd);
+                ::close(hidComplexFd);
+                hidComplexFd = -1;
+                pollCDU();
+                return;
+            }
+        } else {
+            len = hid_read_timeout(hidComplexDevice, report, sizeof(report), 0);
+        }
+
         if (len == 0)
             return; // no report to read
 
@@ -356,8 +457,81 @@ void readCDU()
     }
 }
 
+// read through hidapi at a fixed interval, when there's no hidraw fd to
+// wait on
+void pollCDU()
+{
+    eventLoop.addTimer(std::chrono::milliseconds(hidPollIntervalMsec), [](uint64_t) {
+        readCDU();
+        checkConnection();
+    });
+}
+
+void connectToFlightGear();
+
+void scheduleReconnect(int delaySec)
+{
+    eventLoop.addTimer(std::chrono::seconds(delaySec), [](uint64_t) {
+        connectToFlightGear();
+    }, false /* one-shot */);
+}
+
+// the socket closes itself on read or write failures, including writes
+// made from key handlers, so this is checked after each batch of work
+void checkConnection()
+{
+    if ((registeredSocketFd < 0) || telnetSocket.isConnected()) {
+        return;
+    }
+
+    eventLoop.removeFd(registeredSocketFd);
+    registeredSocketFd = -1;
+    telnetSocket.close();
+
+    setLamp(Lamp::Fail, true);
+    setLCDEnabled(false);
+    scheduleReconnect(0);
+}
+
+void connectToFlightGear()
+{
+    if (!telnetSocket.connect(host, port)) {
+        startBackoffBlink();
+        scheduleReconnect(reconnectBackoff);
+        reconnectBackoff = std::min(reconnectBackoff * 2, 30);
+        return;
+    }
+
+    reconnectBackoff = defaultReconnectBackoff;
+    stopBackoffBlink();
+
+    if (!getInitialState()) {
+        std::cerr << "failed to get initial state, will re-try" << std::endl;
+        telnetSocket.close();
+        scheduleReconnect(0);
+        return;
+    }
+
+    setupSubscriptions();
+    cout << "CDU connected to FlightGear" << endl;
+    setLamp(Lamp::Fail, false);
+    setLCDEnabled(true);
+
+    registeredSocketFd = telnetSocket.fd();
+    eventLoop.addFd(registeredSocketFd, EventLoop::Readable, [](unsigned int events) {
+        if (events & EventLoop::Error) {
+            std::cerr << "socket error during poll" << std::endl;
+            telnetSocket.close();
+        } else {
+            telnetSocket.readAvailable(pollHandler);
+        }
+        checkConnection();
+    });
+}
+
 void exitCleanup()
 {
+    outputs.printStats(cout);
     cout << "Shutting down CDU HID..." << endl;
     shutdownCDU();
 }
@@ -365,12 +539,10 @@ void exitCleanup()
 int main(int argc, char* argv[])
 {
 // arg override if needed
-    std::string host = fgfsHost;
     if (argc > 1) {
         host = argv[1];
     }
 
-    int port = fgfsPort;
     if (argc > 2) {
         port = std::stoi(std::string(argv[2]));
     }
@@ -393,64 +565,33 @@ int main(int argc, char* argv[])
 
     initCDU();
 
-    int reconnectBackoff = defaultReconnectBackoff;
-    time_t lastReadTime = time(nullptr);
-
-    while (keepRunning) {
-        if (!telnetSocket.isConnected()) {
-            setLamp(Lamp::Fail, true);
-            setLCDEnabled(false);
-            
-            if (!telnetSocket.connect(host, port)) {
-                idleForTime(reconnectBackoff);
-                reconnectBackoff = std::min(reconnectBackoff * 2, 30);
-                continue;
-            }
-
-            reconnectBackoff = defaultReconnectBackoff;
-
-            if (!getInitialState()) {
-                std::cerr << "failed to get initial state, will re-try" << std::endl;
-                telnetSocket.close();
-                continue;
-            }
-
-            setupSubscriptions();
-            cout << "CDU connected to FlightGear" << endl;
-            setLamp(Lamp::Fail, false);
-            setLCDEnabled(true);
-        }
+    if (hidComplexFd >= 0) {
+        eventLoop.addFd(hidComplexFd, EventLoop::Readable, [](unsigned int) {
+            readCDU();
+            checkConnection();
+        });
+    } else {
+        pollCDU();
+    }
 
-        time_t nowSeconds = time(nullptr);
-        if ((nowSeconds - lastReadTime) > keepAliveInterval) {
-            // force a write to check for dead socket
-            lastReadTime = nowSeconds;
+    eventLoop.addTimer(std::chrono::seconds(keepAliveInterval), [](uint64_t) {
+        // force a write to check for dead socket
+        if (telnetSocket.isConnected()) {
             telnetSocket.write("pwd");
+            checkConnection();
         }
+    });
 
-        readCDU();
-
-        bool ok = telnetSocket.poll(pollHandler, 50);
-        if (!ok) {
-            // poll failed, close out
-            telnetSocket.close();
-            continue;
-        }
+    outputs.add(&cduLamps);
+    eventLoop.addTimer(std::chrono::milliseconds(outputTickMsec), [](uint64_t) {
+        outputs.commit();
+    });
 
-        // pollGearLeverState(socket);
-        // pollWEUButtons(socket);
-
-        // if (LEDUpdateRequired) {
-        //     LEDUpdateRequired = false;
-        //     updateGearLEDState();
-        // }
+    setLamp(Lamp::Fail, true);
+    setLCDEnabled(false);
+    connectToFlightGear();
 
-        // if (SixpackLEDUpdateRequired) {
-        //     SixpackLEDUpdateRequired = false;
-        //     updateLampLEDState();
-        // }
-        // check for kill signal
-    }
+    eventLoop.run();
 
     // atexit handler will run to shutdown HID
     return EXIT_SUCCESS;
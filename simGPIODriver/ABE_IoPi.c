@@ -17,9 +17,9 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <errno.h>
-#include <fcntl.h>
-#include <linux/i2c-dev.h>
+
+#include "ABE_IoPi.h"
+#include "I2CBusAPI.h"
 
 #define IODIRA 0x00 // IO direction A - 1= input 0 = output
 #define IODIRB 0x01 // IO direction B - 1= input 0 = output
@@ -82,60 +82,27 @@ static char config = 0x22;
 
 // local methods
 
-static int i2cbus;
-const char *fileName = "/dev/i2c-1"; // change to /dev/i2c-0 if you are using a revision 0002 or 0003 model B
-unsigned char buf[10] = { 0 };
+// all bus access goes through the shared I2CBus manager, on the adapter
+// the calling thread selected. Reads are input scans, writes are lamp
+// outputs.
 
 int read_byte_data(char address, char reg) {
+	/*
+	 returns -1 when the read fails
+	 */
+	unsigned char value = 0;
 
-	if ((i2cbus = open(fileName, O_RDWR)) < 0) {
-		printf("Failed to open i2c port for read %s \n", strerror(errno));
-
-		exit(1);
-	}
-
-	if (ioctl(i2cbus, I2C_SLAVE, address) < 0) {
-		printf("Failed to write to i2c port for read\n");
-		exit(1);
-	}
-
-	buf[0] = reg;
-
-	if ((write(i2cbus, buf, 1)) != 1) {
-		printf("Failed to write to i2c device for read\n");
-		exit(1);
-	}
-
-	if (read(i2cbus, buf, 1) != 1) { // Read back data into buf[]
-		printf("Failed to read from slave\n");
-		exit(1);
+	if (i2c_bus_read(I2C_PRIORITY_INPUT, address, reg, &value, 1) < 0) {
+		// reported and counted by the bus manager
+		return (-1);
 	}
 
-	close(i2cbus);
-
-	return (buf[0]);
+	return (value);
 }
 
 void write_byte_data(char address, char reg, char value) {
-	if ((i2cbus = open(fileName, O_RDWR)) < 0) {
-		printf("Failed to open i2c port for write\n");
-		exit(1);
-	}
-
-	if (ioctl(i2cbus, I2C_SLAVE, address) < 0) {
-		printf("Failed to write to i2c port for write\n");
-		exit(1);
-	}
-
-	buf[0] = reg;
-	buf[1] = value;
-
-	if ((write(i2cbus, buf, 2)) != 2) {
-		printf("Failed to write to i2c device for write\n");
-		exit(1);
-	}
-
-	close(i2cbus);
+	unsigned char v = value;
+	i2c_bus_write(I2C_PRIORITY_LAMP, address, reg, &v, 1);
 }
 
 static char updatebyte(char byte, char bit, char value) {
@@ -151,6 +118,28 @@ static char updatebyte(char byte, char bit, char value) {
 
 }
 
+static char read_or_zero(char address, char reg) {
+	/*
+	 internal method for the plain reads, where a failed read reads as
+	 all pins low
+	 */
+	int value = read_byte_data(address, reg);
+	return (value < 0 ? 0 : value);
+}
+
+static void update_register_bit(char address, char reg, char bit, char value) {
+	/*
+	 internal method for setting one bit of a register, leaving the others.
+	 When the read fails nothing is written, rather than writing back a
+	 register of guessed bits.
+	 */
+	int byte = read_byte_data(address, reg);
+	if (byte < 0) {
+		return;
+	}
+	write_byte_data(address, reg, updatebyte(byte, bit, value));
+}
+
 static char checkbit(char byte, char bit) {
 	/*
 	 internal method for reading the value of a single bit within a byte
@@ -172,15 +161,10 @@ void set_pin_direction(char address, char pin, char direction) {
 	* @param direction - 1 = input, 0 = output
 	*/
 	pin = pin - 1;
-	char cval = 0;
 	if (pin < 8) {
-		cval = read_byte_data(address, IODIRA);
-		cval = updatebyte(cval, pin, direction);
-		write_byte_data(address, IODIRA, cval);
+		update_register_bit(address, IODIRA, pin, direction);
 	} else {
-		cval = read_byte_data(address, IODIRB);
-		cval = updatebyte(cval, pin - 8, direction);
-		write_byte_data(address, IODIRB, cval);
+		update_register_bit(address, IODIRB, pin - 8, direction);
 	}
 }
 
@@ -207,15 +191,10 @@ void set_pin_pullup(char address, char pinval, char value) {
 	* @param value - 1 = enabled, 0 = disabled
 	*/
 	pinval = pinval - 1;
-	char cval = 0;
 	if (pinval < 8) {
-		cval = read_byte_data(address, GPPUA);
-		cval = updatebyte(cval, pinval, value);
-		write_byte_data(address, GPPUA, cval);
+		update_register_bit(address, GPPUA, pinval, value);
 	} else {
-		cval = read_byte_data(address, GPPUB);
-		cval = updatebyte(cval, pinval - 8, value);
-		write_byte_data(address, GPPUB, cval);
+		update_register_bit(address, GPPUB, pinval - 8, value);
 	}
 }
 
@@ -241,15 +220,10 @@ void write_pin(char address, char pin, char value) {
 	* @param value - 0 = logic level low, 1 = logic level high
 	*/
 	pin = pin - 1;
-	char cval = 0;
 	if (pin < 8) {
-		cval = read_byte_data(address, GPIOA);
-		cval = updatebyte(cval, pin, value);
-		write_byte_data(address, GPIOA, cval);
+		update_register_bit(address, GPIOA, pin, value);
 	} else {
-		cval = read_byte_data(address, GPIOB);
-		cval = updatebyte(cval, pin - 8, value);
-		write_byte_data(address, GPIOB, cval);
+		update_register_bit(address, GPIOB, pin - 8, value);
 	}
 }
 
@@ -276,10 +250,10 @@ int read_pin(char address, char pinval) {
 	*/
 	pinval = pinval - 1;
 	if (pinval < 8) {
-		return (checkbit(read_byte_data(address, GPIOA), pinval));
+		return (checkbit(read_or_zero(address, GPIOA), pinval));
 	} else {
 		pinval = pinval - 8;
-		return (checkbit(read_byte_data(address, GPIOB), pinval));
+		return (checkbit(read_or_zero(address, GPIOB), pinval));
 	}
 }
 
@@ -291,9 +265,9 @@ char read_port(char address, char port) {
 	* @returns - number between 0 and 255 or 0x00 and 0xFF
 	*/
 	if (port == 1) {
-		return (read_byte_data(address, GPIOB));
+		return (read_or_zero(address, GPIOB));
 	} else {
-		return (read_byte_data(address, GPIOA));
+		return (read_or_zero(address, GPIOA));
 	}
 }
 
@@ -319,15 +293,10 @@ void invert_pin(char address, char pin, char polarity) {
 	* @param polarity - 0 = same logic state of the input pin, 1 = inverted logic	state of the input pin
 	*/
 	pin = pin - 1;
-	char cval = 0;
 	if (pin < 8) {
-		cval = read_byte_data(address, IPOLA);
-		cval = updatebyte(cval, pin, polarity);
-		write_byte_data(address, IPOLA, cval);
+		update_register_bit(address, IPOLA, pin, polarity);
 	} else {
-		cval = read_byte_data(address, IPOLB);
-		cval = updatebyte(cval, pin - 8, polarity);
-		write_byte_data(address, IPOLB, cval);
+		update_register_bit(address, IPOLB, pin - 8, polarity);
 	}
 }
 
@@ -412,15 +381,10 @@ void set_interrupt_on_pin(char address, char pin, char value) {
 	* @param value - 0 = interrupt disabled, 1 = interrupt enabled
 	*/
 	pin = pin - 1;
-	char cval = 0;
 	if (pin < 8) {
-		cval = read_byte_data(address, GPINTENA);
-		cval = updatebyte(cval, pin, value);
-		write_byte_data(address, GPINTENA, cval);
+		update_register_bit(address, GPINTENA, pin, value);
 	} else {
-		cval = read_byte_data(address, GPINTENB);
-		cval = updatebyte(cval, pin - 8, value);
-		write_byte_data(address, GPINTENB, cval);
+		update_register_bit(address, GPINTENB, pin - 8, value);
 	}
 }
 
@@ -431,9 +395,9 @@ char read_interrupt_status(char address, char port) {
 	* @param port - 0 = pins 1 to 8, port 1 = pins 9 to 16
 	*/
 	if (port == 0) {
-		return (read_byte_data(address, INTFA));
+		return (read_or_zero(address, INTFA));
 	} else {
-		return (read_byte_data(address, INTFB));
+		return (read_or_zero(address, INTFB));
 	}
 }
 
@@ -445,9 +409,9 @@ char read_interrupt_capture(char address, char port) {
 	* @param port - 0 = pins 1 to 8, port 1 = pins 9 to 16
 	*/
 	if (port == 0) {
-		return (read_byte_data(address, INTCAPA));
+		return (read_or_zero(address, INTCAPA));
 	} else {
-		return (read_byte_data(address, INTCAPB));
+		return (read_or_zero(address, INTCAPB));
 	}
 }
 
@@ -460,6 +424,40 @@ void reset_interrupts(char address) {
 	read_interrupt_capture(address, 1);
 }
 
+int read_ports_multi(const char *addresses, int count, unsigned char *values) {
+	/**
+	* read both ports of several chips in a single I2C_RDWR transaction
+	* @param addresses - I2C addresses of the target devices
+	* @param count - number of devices, 1 to IOPI_MAX_MULTI_READ
+	* @param values - receives two bytes per device, port 0 then port 1
+	* @returns - 0 on success, -1 on failure
+	*/
+	unsigned char reg = GPIOA;
+	I2CMessage msgs[IOPI_MAX_MULTI_READ * 2];
+	int i;
+
+	if ((count < 1) || (count > IOPI_MAX_MULTI_READ)) {
+		return -1;
+	}
+
+	// with IOCON.BANK = 0 the address pointer moves from GPIOA to GPIOB
+	// (toggling or incrementing depending on SEQOP), so a two byte read
+	// starting at GPIOA returns both ports
+	for (i = 0; i < count; i++) {
+		msgs[i * 2].address = addresses[i];
+		msgs[i * 2].flags = 0;
+		msgs[i * 2].length = 1;
+		msgs[i * 2].data = &reg;
+
+		msgs[i * 2 + 1].address = addresses[i];
+		msgs[i * 2 + 1].flags = I2C_MSG_READ;
+		msgs[i * 2 + 1].length = 2;
+		msgs[i * 2 + 1].data = values + (i * 2);
+	}
+
+	return i2c_bus_transfer(I2C_PRIORITY_INPUT, msgs, count * 2);
+}
+
 void IOPi_init(char address) {
 	/**
 	* initialise the MCP32017 IO chip with default values: ports are inputs, pull-up resistors are disabled and ports are not inverted
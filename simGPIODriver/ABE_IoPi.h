@@ -87,6 +87,18 @@ int read_pin(char address, char pinval);
 */
 char read_port(char address, char port);
 
+// the kernel accepts at most 42 messages per I2C_RDWR, two per device
+#define IOPI_MAX_MULTI_READ 21
+
+/**
+* read both ports of several chips in a single I2C_RDWR transaction
+* @param addresses - I2C addresses of the target devices
+* @param count - number of devices, 1 to IOPI_MAX_MULTI_READ
+* @param values - receives two bytes per device, port 0 then port 1
+* @returns - 0 on success, -1 on failure
+*/
+int read_ports_multi(const char *addresses, int count, unsigned char *values);
+
 /**
 * invert the polarity of the pins on a selected port
 * @param address - I2C address for the target device
@@ -17,20 +17,16 @@
 
 #include "Adafruit_PWMServoDriver.h"
 
-#include <linux/i2c-dev.h>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <algorithm>
 #include <cmath>
-#include <errno.h>
-#include <fcntl.h>
 #include <unistd.h> // for usleep
-#include <sys/ioctl.h>
 
 #include <iostream>
 
-static const char *fileName = "/dev/i2c-1"; // change to /dev/i2c-0 if you are using a revision 0002 or 0003 model B
+#include "I2CBus.h"
 
 // Set to true to print some debug messages, or false to disable them.
 //#define ENABLE_DEBUG_OUTPUT
@@ -40,21 +36,13 @@ static const char *fileName = "/dev/i2c-1"; // change to /dev/i2c-0 if you are u
 /*! 
     @brief  Instantiates a new PCA9685 PWM driver chip with the I2C address on the Wire interface. On Due we use Wire1 since its the interface on the 'default' I2C pins.
     @param  addr The 7-bit I2C address to locate this chip, default is 0x40
+    @param  bus The /dev/i2c-<n> adapter the chip is wired to, default is 1
 */
 /**************************************************************************/
-Adafruit_PWMServoDriver::Adafruit_PWMServoDriver(uint8_t addr, float freq) 
+Adafruit_PWMServoDriver::Adafruit_PWMServoDriver(uint8_t addr, float freq, int bus) 
 {
   _i2caddr = addr;
-
-  if ((_i2cHandle = open(fileName, O_RDWR)) < 0) {
-		printf("Failed to open i2c port for read %s \n", strerror(errno));
-		exit(1);
-	}
-
-	if (ioctl(_i2cHandle, I2C_SLAVE, _i2caddr) < 0) {
-		printf("Failed to write to i2c port for read\n");
-		exit(1);
-	}
+  _bus = &I2CBus::get(bus);
 
 // prescale compuation
   freq *= 0.9;  // Correct for overshoot in the frequency setting (see issue #11).
@@ -64,7 +52,7 @@ Adafruit_PWMServoDriver::Adafruit_PWMServoDriver(uint8_t addr, float freq)
   prescaleval -= 1;
 
   _prescale = floor(prescaleval + 0.5);
-  std::cerr << "Final prescale:" << std::hex << (int) _prescale << std::endl;
+  std::cerr << "Final prescale:" << std::hex << (int) _prescale << std::dec << std::endl;
 }
 
 
@@ -87,8 +75,15 @@ void Adafruit_PWMServoDriver::begin(void)
   write8(PCA9685_MODE1, SLEEP); // go to sleep
   usleep(1000); // wait for oscillator to shut down
   write8(PCA9685_PRESCALE, _prescale); // set the prescaler
+  // unlike the PCA9622, auto-increment is a MODE1 bit here; setPWM()
+  // and commit() rely on it
   write8(PCA9685_MODE1, ALLCALL | AUTO_INCREMENT | 0x80); // wake up
   usleep(1000); // wait for oscillator to come back up
+
+  // the reset left every output fully off
+  std::fill(std::begin(_on), std::end(_on), 0);
+  std::fill(std::begin(_off), std::end(_off), 0x1000);
+  _dirty = 0;
 }
 
 /**************************************************************************/
@@ -116,16 +111,88 @@ void Adafruit_PWMServoDriver::setPWM(uint8_t num, uint16_t on, uint16_t off) {
 #endif
 
 // note this requires auto-increment to be active
-  uint8_t buf[5] = {LED0_ON_L+4*num,
-    on & 0xff, 
-    on >> 8, 
-    off & 0xff, 
-    off >> 8 };
-
-  if ((write(_i2cHandle, buf, 5)) != 5) {
-		printf("Failed to write to i2c device for write\n");
-		exit(1);
-	}
+  uint8_t buf[4] = {
+    static_cast<uint8_t>(on & 0xff),
+    static_cast<uint8_t>(on >> 8),
+    static_cast<uint8_t>(off & 0xff),
+    static_cast<uint8_t>(off >> 8) };
+
+  _bus->writeRegisters(I2CPriority::Gauge, _i2caddr, LED0_ON_L+4*num, buf, 4);
+  _on[num] = on;
+  _off[num] = off;
+  _dirty &= ~(1u << num);
+}
+
+/**************************************************************************/
+/*!
+    @brief  Sets the PWM output of one of the PCA9685 pins in the shadow
+            registers only, to be written by the next commit()
+    @param  num One of the PWM output pins, from 0 to 15
+    @param  on At what point in the 4096-part cycle to turn the PWM output ON
+    @param  off At what point in the 4096-part cycle to turn the PWM output OFF
+*/
+/**************************************************************************/
+void Adafruit_PWMServoDriver::stagePWM(uint8_t num, uint16_t on, uint16_t off)
+{
+  if ((_on[num] == on) && (_off[num] == off)) {
+    return;
+  }
+
+  _on[num] = on;
+  _off[num] = off;
+  _dirty |= 1u << num;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Counts the channels staged and not yet written by commit()
+    @return The number of dirty channels, from 0 to 16
+*/
+/**************************************************************************/
+unsigned int Adafruit_PWMServoDriver::dirtyChannels(void) const
+{
+  return __builtin_popcount(_dirty);
+}
+
+/**************************************************************************/
+/*!
+    @brief  Writes the channels staged since the last commit as one
+            auto-increment burst starting at LED0_ON_L+4*n, from the lowest
+            dirty channel to the highest. Clean channels in between are
+            rewritten with their shadow values.
+    @return false if the write failed; everything stays dirty
+*/
+/**************************************************************************/
+bool Adafruit_PWMServoDriver::commit(void)
+{
+  if (!_dirty) {
+    return true;
+  }
+
+  uint8_t first = 0;
+  while (!(_dirty & (1u << first))) {
+    ++first;
+  }
+  uint8_t last = 15;
+  while (!(_dirty & (1u << last))) {
+    --last;
+  }
+
+  uint8_t frame[16 * 4];
+  uint8_t* p = frame;
+  for (uint8_t num = first; num <= last; ++num) {
+    *p++ = _on[num] & 0xff;
+    *p++ = _on[num] >> 8;
+    *p++ = _off[num] & 0xff;
+    *p++ = _off[num] >> 8;
+  }
+
+  if (!_bus->writeRegisters(I2CPriority::Gauge, _i2caddr, LED0_ON_L+4*first, frame, p - frame)) {
+    return false;
+  }
+
+  _dirty = 0;
+  return true;
 }
 
 /**************************************************************************/
@@ -172,24 +239,12 @@ void Adafruit_PWMServoDriver::setPin(uint8_t num, uint16_t val, bool invert)
 
 uint8_t Adafruit_PWMServoDriver::read8(uint8_t addr) 
 {
-  uint8_t buf[1] = { addr };
-  if ((write(_i2cHandle, buf, 1)) != 1) {
-		printf("Failed to write to i2c device for write\n");
-		exit(1);
-	}
-
-  if (read(_i2cHandle, buf, 1) != 1) { // Read back data into buf[]
-		printf("Failed to read from slave\n");
-		exit(1);
-	}
-
-  return buf[0];
+  uint8_t value = 0;
+  // on failure the bus manager reports and counts the error
+  _bus->readRegisters(I2CPriority::Gauge, _i2caddr, addr, &value, 1);
+  return value;
 }
 
 void Adafruit_PWMServoDriver::write8(uint8_t addr, uint8_t d) {
-  uint8_t buf[2] = { addr, d };
-  if ((write(_i2cHandle, buf, 2)) != 2) {
-		printf("Failed to write to i2c device for write\n");
-		exit(1);
-	}
+  _bus->writeRegisters(I2CPriority::Gauge, _i2caddr, addr, &d, 1);
 }
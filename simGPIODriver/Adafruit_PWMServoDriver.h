@@ -39,6 +39,8 @@
 
 #include <cstdint>
 
+class I2CBus;
+
 /**************************************************************************/
 /*! 
     @brief  Class that stores state and functions for interacting with PCA9685 PWM chip
@@ -46,7 +48,7 @@
 /**************************************************************************/
 class Adafruit_PWMServoDriver {
  public:
-  Adafruit_PWMServoDriver(uint8_t addr = 0x40, float freq = 60.0);
+  Adafruit_PWMServoDriver(uint8_t addr = 0x40, float freq = 60.0, int bus = 1);
 
   void begin(void);
   void reset(void);
@@ -54,11 +56,20 @@ class Adafruit_PWMServoDriver {
   void setPWM(uint8_t num, uint16_t on, uint16_t off);
   void setPin(uint8_t num, uint16_t val, bool invert=false);
 
+  void stagePWM(uint8_t num, uint16_t on, uint16_t off);
+  bool commit(void);
+  unsigned int dirtyChannels(void) const;
+
  private:
   uint8_t _i2caddr;
-  int _i2cHandle = 0;
+  I2CBus* _bus = nullptr;
   uint8_t _prescale = 0;
 
+  // shadow of LEDn_ON and LEDn_OFF, which only this driver writes
+  uint16_t _on[16] = {};
+  uint16_t _off[16] = {};
+  uint16_t _dirty = 0; // bit per channel
+
   uint8_t read8(uint8_t addr);
   void write8(uint8_t addr, uint8_t d);
 };
@@ -0,0 +1,252 @@
+#include "AircraftProfile.h"
+
+#include <algorithm>
+#include <sstream>
+#include <cstdlib>
+#include <memory>
+
+#include "JSON.h"
+
+bool PanelLayout::lamp(uint8_t address, unsigned int channel, LampRef& result) const
+{
+    for (const auto& l : lamps) {
+        if ((l.address == address) && (l.channel == channel)) {
+            result = l.lamp;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool LampRule::evaluate(const std::string& value) const
+{
+    if (!numeric) {
+        return (value == "true") || (atof(value.c_str()) != 0.0);
+    }
+
+    const double v = atof(value.c_str());
+    const bool aboveMin = minInclusive ? (v >= min) : (v > min);
+    const bool belowMax = maxInclusive ? (v <= max) : (v < max);
+    return aboveMin && belowMax;
+}
+
+AircraftProfile::AircraftProfile(const std::string& name, BindingSet bindings) :
+    _name(name),
+    _bindings(std::move(bindings))
+{
+}
+
+bool AircraftProfile::matches(const std::string& aircraft) const
+{
+    for (const auto& id : _aircraft) {
+        if (aircraft.compare(0, id.size(), id) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void AircraftProfile::addLamp(const LampRule& rule)
+{
+    _lampsByPath[normalizePath(rule.property)].push_back(_lamps.size());
+    _lamps.push_back(rule);
+    addSubscription(rule.property);
+}
+
+void AircraftProfile::addSubscription(const std::string& path)
+{
+    if (std::find(_subscriptions.begin(), _subscriptions.end(), path) == _subscriptions.end()) {
+        _subscriptions.push_back(path);
+    }
+}
+
+bool AircraftProfile::update(const std::string& path, const std::string& value) const
+{
+    const auto it = _lampsByPath.find(normalizePath(path));
+    if (it == _lampsByPath.end()) {
+        return false;
+    }
+
+    for (size_t index : it->second) {
+        const LampRule& rule = _lamps[index];
+        rule.lamp.set(rule.evaluate(value));
+    }
+    return true;
+}
+
+bool AircraftProfile::drives(LampRef lamp) const
+{
+    for (const auto& rule : _lamps) {
+        if (rule.lamp == lamp) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void AircraftProfile::lampsOff(const AircraftProfile* next) const
+{
+    for (const auto& rule : _lamps) {
+        if (!next || !next->drives(rule.lamp)) {
+            rule.lamp.set(false);
+        }
+    }
+}
+
+std::string AircraftProfile::normalizePath(const std::string& path)
+{
+    std::string result = path;
+    size_t pos;
+    while ((pos = result.find("[0]")) != std::string::npos) {
+        result.erase(pos, 3);
+    }
+    return result;
+}
+
+// <found> says whether the lamp has either limit; false if it isn't a number
+static bool readLimit(const JSONValue& lamp, const char* inclusive, const char* exclusive,
+                      double& limit, bool& isInclusive, bool& found, std::string& error)
+{
+    const JSONValue* v = lamp.find(inclusive);
+    isInclusive = (v != nullptr);
+    if (!v) {
+        v = lamp.find(exclusive);
+    }
+
+    found = (v != nullptr);
+    if (!v) {
+        return true;
+    }
+
+    if (!v->isNumber()) {
+        error = "\"" + std::string(isInclusive ? inclusive : exclusive) + "\" must be a number";
+        return false;
+    }
+
+    limit = v->number();
+    return true;
+}
+
+// an optional array of strings
+static bool readStrings(const JSONValue& doc, const char* key, const std::string& path,
+                        std::vector<std::string>& result, std::string& error)
+{
+    const JSONValue* v = doc.find(key);
+    if (!v) {
+        return true;
+    }
+
+    if (!v->isArray()) {
+        error = path + ":" + std::to_string(v->line()) + ": \"" + key + "\" must be an array of strings";
+        return false;
+    }
+
+    for (const JSONValue& s : v->array()) {
+        if (!s.isString()) {
+            error = path + ":" + std::to_string(s.line()) + ": \"" + key + "\" must be an array of strings";
+            return false;
+        }
+        result.push_back(s.string());
+    }
+    return true;
+}
+
+AircraftProfile* AircraftProfile::loadJSON(const std::string& path, const PanelLayout& layout, std::string& error)
+{
+    JSONValue doc;
+    if (!JSONValue::parseFile(path, doc, error)) {
+        return nullptr;
+    }
+
+    const JSONValue* name = doc.isObject() ? doc.find("name") : nullptr;
+    if (!name || !name->isString()) {
+        error = path + ": expected an object with a \"name\"";
+        return nullptr;
+    }
+
+    BindingSet bindings(layout.chips, layout.reserved);
+    if (const JSONValue* b = doc.find("bindings")) {
+        if (!bindings.addJSON(*b, path, error)) {
+            return nullptr;
+        }
+    }
+
+    std::unique_ptr<AircraftProfile> profile(new AircraftProfile(name->string(), std::move(bindings)));
+
+    std::vector<std::string> aircraft, subscriptions;
+    if (!readStrings(doc, "aircraft", path, aircraft, error) || !readStrings(doc, "subscribe", path, subscriptions, error)) {
+        return nullptr;
+    }
+    for (const auto& id : aircraft) {
+        profile->addAircraft(id);
+    }
+
+    if (const JSONValue* lamps = doc.find("lamps")) {
+        if (!lamps->isArray()) {
+            error = path + ":" + std::to_string(lamps->line()) + ": \"lamps\" must be an array";
+            return nullptr;
+        }
+
+        for (const JSONValue& l : lamps->array()) {
+            std::ostringstream prefix;
+            prefix << path << ":" << l.line() << ": ";
+            if (!l.isObject()) {
+                error = prefix.str() + "lamp must be an object";
+                return nullptr;
+            }
+
+            const JSONValue* property = l.find("property");
+            if (!property || !property->isString()) {
+                error = prefix.str() + "lamp needs a \"property\"";
+                return nullptr;
+            }
+
+            LampRule rule;
+            rule.property = property->string();
+
+            uint8_t address;
+            unsigned int channel;
+            if (l.find("channel")) {
+                int a, c;
+                if (!readJSONInt(l, "address", a, error) || !readJSONInt(l, "channel", c, error)) {
+                    error = prefix.str() + error;
+                    return nullptr;
+                }
+                address = static_cast<uint8_t>(a);
+                channel = static_cast<unsigned int>(c);
+            } else {
+                PinRef pin;
+                if (!readJSONPin(l, pin, error)) {
+                    error = prefix.str() + error;
+                    return nullptr;
+                }
+                address = pin.address;
+                channel = pin.port * 8 + pin.bit;
+            }
+
+            if (!layout.lamp(address, channel, rule.lamp)) {
+                error = prefix.str() + "not a lamp output";
+                return nullptr;
+            }
+
+            bool hasMin, hasMax;
+            if (!readLimit(l, "min", "above", rule.min, rule.minInclusive, hasMin, error) ||
+                !readLimit(l, "max", "below", rule.max, rule.maxInclusive, hasMax, error))
+            {
+                error = prefix.str() + error;
+                return nullptr;
+            }
+            rule.numeric = hasMin || hasMax;
+            profile->addLamp(rule);
+        }
+    }
+
+    for (const auto& p : subscriptions) {
+        profile->addSubscription(p);
+    }
+
+    return profile.release();
+}
@@ -0,0 +1,112 @@
+#ifndef AIRCRAFT_PROFILE_H
+#define AIRCRAFT_PROFILE_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <utility>
+#include <cmath>
+
+#include "GPIO.h"
+#include "PanelBindings.h"
+#include "OutputSink.h"
+
+// what the hardware offers a profile: expanders in InputWord order, pins
+// switch bindings may not use, and the lamps by chip address and channel
+// (port * 8 + bit on an expander)
+struct PanelLayout
+{
+    struct Lamp
+    {
+        uint8_t address;
+        unsigned int channel;
+        LampRef lamp;
+    };
+
+    std::vector<uint8_t> chips;
+    std::vector<PinRef> reserved;
+    std::vector<Lamp> lamps;
+
+    bool lamp(uint8_t address, unsigned int channel, LampRef& result) const;
+};
+
+// a lamp following one property: on while a boolean property is true, or
+// while a numeric one lies within the limits
+struct LampRule
+{
+    std::string property;
+    LampRef lamp;
+
+    bool numeric = false;
+    double min = -HUGE_VAL; // lamp on above this, or at it when inclusive
+    bool minInclusive = true;
+    double max = HUGE_VAL;
+    bool maxInclusive = true;
+
+    bool evaluate(const std::string& value) const;
+};
+
+// Everything aircraft-specific the driver does: the properties it
+// subscribes to, the switch bindings and the lamp logic. Profiles are
+// chosen by /sim/aircraft and can be swapped while connected; the panel
+// hardware is the same for all of them.
+class AircraftProfile
+{
+public:
+    AircraftProfile(const std::string& name, BindingSet bindings);
+
+    const std::string& name() const
+    {
+        return _name;
+    }
+
+    // /sim/aircraft values starting with <id> select this profile
+    void addAircraft(const std::string& id)
+    {
+        _aircraft.push_back(id);
+    }
+
+    bool matches(const std::string& aircraft) const;
+
+    const BindingSet& bindings() const
+    {
+        return _bindings;
+    }
+
+    void addLamp(const LampRule& rule);
+
+    // subscribed to without driving a lamp
+    void addSubscription(const std::string& path);
+
+    // every property the profile needs, lamp properties included
+    const std::vector<std::string>& subscriptions() const
+    {
+        return _subscriptions;
+    }
+
+    // apply a property value; false if this profile doesn't use <path>
+    bool update(const std::string& path, const std::string& value) const;
+
+    bool drives(LampRef lamp) const;
+
+    // switch off the lamps this profile drives and <next> doesn't
+    void lampsOff(const AircraftProfile* next = nullptr) const;
+
+    // {"name", "aircraft": [...], "bindings": [...], "lamps": [...],
+    //  "subscribe": [...]}, or nullptr with <error> set. A lamp is an
+    //  "address" with a "port" and "bit", or a "channel".
+    static AircraftProfile* loadJSON(const std::string& path, const PanelLayout& layout, std::string& error);
+
+    // FlightGear's telnet server leaves out [0] indices in updates
+    static std::string normalizePath(const std::string& path);
+private:
+    std::string _name;
+    std::vector<std::string> _aircraft;
+    BindingSet _bindings;
+
+    std::vector<LampRule> _lamps;
+    std::vector<std::string> _subscriptions;
+    std::unordered_map<std::string, std::vector<size_t>> _lampsByPath; // normalized
+};
+
+#endif
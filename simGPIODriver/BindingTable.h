@@ -0,0 +1,175 @@
+#ifndef BINDING_TABLE_H
+#define BINDING_TABLE_H
+
+#include <cstdint>
+#include <cstddef>
+
+#include "GPIO.h"
+
+// A panel's switch wiring as constexpr data. The checks below run when the
+// table is compiled, so a pin wired twice, an input that is also a lamp or
+// a port that doesn't exist is a build error instead of a surprise on the
+// Pi. BindingSet::addTable() compiles the table into the same flat arrays
+// as bindings loaded from JSON.
+
+struct PinRef
+{
+    uint8_t address;
+    uint8_t port;
+    uint8_t bit;
+};
+
+enum class BindingAction : uint8_t
+{
+    None, // log only
+    Write, // send <target> as a command line
+    Property // set property <target> to <value>
+};
+
+struct PinBinding
+{
+    PinRef pin;
+    Trigger trigger;
+    const char* label; // logged when the binding fires
+    BindingAction action;
+    const char* target;
+    const char* value;
+};
+
+constexpr PinBinding logOn(PinRef pin, Trigger t, const char* label)
+{
+    return PinBinding{pin, t, label, BindingAction::None, nullptr, nullptr};
+}
+
+constexpr PinBinding writeOn(PinRef pin, Trigger t, const char* label, const char* command)
+{
+    return PinBinding{pin, t, label, BindingAction::Write, command, nullptr};
+}
+
+constexpr PinBinding setOn(PinRef pin, Trigger t, const char* label, const char* property, const char* value)
+{
+    return PinBinding{pin, t, label, BindingAction::Property, property, value};
+}
+
+namespace binding_detail
+{
+    constexpr bool samePin(PinRef a, PinRef b)
+    {
+        return (a.address == b.address) && (a.port == b.port) && (a.bit == b.bit);
+    }
+
+    constexpr bool triggersOverlap(Trigger a, Trigger b)
+    {
+        return (a == Trigger::AnyEdge) || (b == Trigger::AnyEdge) || (a == b);
+    }
+
+    constexpr bool validPin(PinRef p)
+    {
+        return (p.port < 2) && (p.bit < 8);
+    }
+
+    template <size_t C>
+    constexpr int chipIndex(const uint8_t (&chips)[C], uint8_t address)
+    {
+        for (size_t i = 0; i < C; ++i) {
+            if (chips[i] == address) {
+                return static_cast<int>(i);
+            }
+        }
+        return -1;
+    }
+} // of namespace binding_detail
+
+// every pin names port 0-1, bit 0-7
+template <size_t N>
+constexpr bool validPins(const PinBinding (&table)[N])
+{
+    for (size_t i = 0; i < N; ++i) {
+        if (!binding_detail::validPin(table[i].pin)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <size_t N>
+constexpr bool validPins(const PinRef (&pins)[N])
+{
+    for (size_t i = 0; i < N; ++i) {
+        if (!binding_detail::validPin(pins[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// no pin has two bindings for the same edge; a press and a release
+// binding on one pin are fine
+template <size_t N>
+constexpr bool noDuplicateBindings(const PinBinding (&table)[N])
+{
+    for (size_t i = 0; i < N; ++i) {
+        for (size_t j = i + 1; j < N; ++j) {
+            if (binding_detail::samePin(table[i].pin, table[j].pin) &&
+                binding_detail::triggersOverlap(table[i].trigger, table[j].trigger))
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+template <size_t N>
+constexpr bool noDuplicatePins(const PinRef (&pins)[N])
+{
+    for (size_t i = 0; i < N; ++i) {
+        for (size_t j = i + 1; j < N; ++j) {
+            if (binding_detail::samePin(pins[i], pins[j])) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// none of <pins> (outputs, or inputs used some other way) has a binding
+template <size_t N, size_t M>
+constexpr bool unbound(const PinBinding (&table)[N], const PinRef (&pins)[M])
+{
+    for (size_t i = 0; i < N; ++i) {
+        for (size_t j = 0; j < M; ++j) {
+            if (binding_detail::samePin(table[i].pin, pins[j])) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+template <size_t N, size_t M>
+constexpr bool disjoint(const PinRef (&a)[N], const PinRef (&b)[M])
+{
+    for (size_t i = 0; i < N; ++i) {
+        for (size_t j = 0; j < M; ++j) {
+            if (binding_detail::samePin(a[i], b[j])) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// every binding is on one of <chips>
+template <size_t C, size_t N>
+constexpr bool knownChips(const uint8_t (&chips)[C], const PinBinding (&table)[N])
+{
+    for (size_t i = 0; i < N; ++i) {
+        if (binding_detail::chipIndex(chips, table[i].pin.address) < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif
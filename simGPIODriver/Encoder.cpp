@@ -0,0 +1,68 @@
+#include "Encoder.h"
+
+#include <cstdlib>
+
+using namespace std::chrono;
+
+// indexed by (previous AB << 2) | current AB: +1 / -1 for a valid Gray
+// code step, 0 for no change, 2 for an impossible jump
+static const int8_t QuadratureTable[16] = {
+    0, -1, 1, 2,
+    1, 0, 2, -1,
+    -1, 2, 0, 1,
+    2, 1, -1, 0
+};
+
+QuadratureEncoder::QuadratureEncoder(unsigned int bitA, unsigned int bitB, int countsPerDetent) :
+    _bitA(bitA),
+    _bitB(bitB),
+    _countsPerDetent(countsPerDetent),
+    _curve({{milliseconds(20), 10}, {milliseconds(50), 4}, {milliseconds(100), 2}})
+{
+}
+
+void QuadratureEncoder::sample(InputWord word, ScanClock::time_point t)
+{
+    const uint8_t ab = (((word >> _bitA) & 1) << 1) | ((word >> _bitB) & 1);
+    if (_state == 0xff) {
+        _state = ab;
+        return;
+    }
+
+    const int8_t step = QuadratureTable[(_state << 2) | ab];
+    _state = ab;
+    if (step == 0) {
+        return;
+    }
+
+    if (step == 2) {
+        // direction unknown; drop the partial detent rather than guess
+        _missed.fetch_add(1, std::memory_order_relaxed);
+        _counts = 0;
+        return;
+    }
+
+    _counts += step;
+    if (std::abs(_counts) >= _countsPerDetent) {
+        detent((_counts > 0) ? 1 : -1, t);
+        _counts = 0;
+    }
+}
+
+void QuadratureEncoder::detent(int direction, ScanClock::time_point t)
+{
+    int multiplier = 1;
+    if (direction == _lastDirection) {
+        const auto interval = t - _lastDetent;
+        for (const auto& s : _curve) {
+            if (interval < s.below) {
+                multiplier = s.multiplier;
+                break;
+            }
+        }
+    }
+
+    _lastDirection = direction;
+    _lastDetent = t;
+    _pending.fetch_add(direction * multiplier, std::memory_order_relaxed);
+}
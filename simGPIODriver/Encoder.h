@@ -0,0 +1,64 @@
+#ifndef ENCODER_H
+#define ENCODER_H
+
+#include <atomic>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+
+#include "GPIO.h"
+
+// A rotary encoder on two expander inputs, decoded from the full input
+// word on the scanner thread. Detents accumulate (with acceleration) into
+// a pending delta, which the network thread collects once per tick.
+class QuadratureEncoder
+{
+public:
+    struct AccelStep
+    {
+        std::chrono::milliseconds below; // interval between detents
+        int multiplier;
+    };
+
+    // bits are InputWord indices, see GPIOBank::addInput()
+    QuadratureEncoder(unsigned int bitA, unsigned int bitB, int countsPerDetent = 4);
+
+    // fastest first; detents further apart than every entry count once
+    void setAcceleration(const std::vector<AccelStep>& curve)
+    {
+        _curve = curve;
+    }
+
+    // scanner thread
+    void sample(InputWord word, ScanClock::time_point t);
+
+    // any thread: detents since the last call, positive clockwise
+    int32_t takeDelta()
+    {
+        return _pending.exchange(0, std::memory_order_relaxed);
+    }
+
+    // transitions where both lines changed between samples, i.e. the
+    // scan rate was too slow for the knob
+    uint32_t missedTransitions() const
+    {
+        return _missed.load(std::memory_order_relaxed);
+    }
+private:
+    void detent(int direction, ScanClock::time_point t);
+
+    const unsigned int _bitA, _bitB;
+    const int _countsPerDetent;
+    std::vector<AccelStep> _curve;
+
+    // scanner thread only
+    uint8_t _state = 0xff; // unknown until the first sample
+    int _counts = 0;
+    int _lastDirection = 0;
+    ScanClock::time_point _lastDetent;
+
+    std::atomic<int32_t> _pending{0};
+    std::atomic<uint32_t> _missed{0};
+};
+
+#endif
@@ -0,0 +1,414 @@
+#include "EventLoop.h"
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#else
+#include <poll.h>
+#endif
+
+using namespace std::chrono;
+
+struct EventLoop::Timer
+{
+    TimerHandler handler;
+    bool repeat = true;
+
+    // only used by the poll() implementation; timerfd tracks these itself
+    steady_clock::time_point deadline;
+    microseconds interval;
+};
+
+#if defined(__linux__)
+
+EventNotifier::EventNotifier()
+{
+    _fds[0] = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (_fds[0] < 0) {
+        perror("failed to create eventfd");
+        exit(1);
+    }
+    _fds[1] = _fds[0];
+}
+
+EventNotifier::~EventNotifier()
+{
+    ::close(_fds[0]);
+}
+
+void EventNotifier::notify()
+{
+    const uint64_t one = 1;
+    // EAGAIN means the counter is saturated, so a wakeup is pending anyway
+    (void) ::write(_fds[1], &one, sizeof(one));
+}
+
+void EventNotifier::drain()
+{
+    uint64_t count;
+    (void) ::read(_fds[0], &count, sizeof(count));
+}
+
+#else
+
+EventNotifier::EventNotifier()
+{
+    if (::pipe(_fds) != 0) {
+        perror("failed to create wakeup pipe");
+        exit(1);
+    }
+
+    for (int i=0; i<2; ++i) {
+        ::fcntl(_fds[i], F_SETFL, ::fcntl(_fds[i], F_GETFL) | O_NONBLOCK);
+        ::fcntl(_fds[i], F_SETFD, FD_CLOEXEC);
+    }
+}
+
+EventNotifier::~EventNotifier()
+{
+    ::close(_fds[0]);
+    ::close(_fds[1]);
+}
+
+void EventNotifier::notify()
+{
+    const char c = 0;
+    (void) ::write(_fds[1], &c, 1);
+}
+
+void EventNotifier::drain()
+{
+    char buf[64];
+    while (::read(_fds[0], buf, sizeof(buf)) > 0) {
+        // discard
+    }
+}
+
+#endif
+
+void EventLoop::dispatchFd(int fd, unsigned int events)
+{
+    auto it = _fdHandlers.find(fd);
+    if (it == _fdHandlers.end()) {
+        return; // removed by an earlier handler in this batch
+    }
+
+    // hold a reference, the handler is allowed to remove itself
+    std::shared_ptr<Watch> watch = it->second;
+    watch->handler(events);
+}
+
+void EventLoop::run()
+{
+    _quit = false;
+    while (!_quit) {
+        runOnce(-1);
+    }
+}
+
+void EventLoop::quit()
+{
+    _quit = true;
+    _wakeup.notify();
+}
+
+#if defined(__linux__)
+
+static uint32_t epollFlags(unsigned int events)
+{
+    uint32_t r = 0;
+    if (events & EventLoop::Readable) r |= EPOLLIN;
+    if (events & EventLoop::Writable) r |= EPOLLOUT;
+    if (events & EventLoop::Priority) r |= EPOLLPRI;
+    return r;
+}
+
+EventLoop::EventLoop()
+{
+    _epollFd = ::epoll_create1(EPOLL_CLOEXEC);
+    if (_epollFd < 0) {
+        perror("epoll_create1 failed");
+        exit(1);
+    }
+
+    addFd(_wakeup.fd(), Readable, [this](unsigned int) {
+        _wakeup.drain();
+    });
+}
+
+EventLoop::~EventLoop()
+{
+    while (!_timers.empty()) {
+        cancelTimer(_timers.begin()->first);
+    }
+
+    ::close(_epollFd);
+}
+
+void EventLoop::addFd(int fd, unsigned int events, FdHandler handler)
+{
+    struct epoll_event ev = {};
+    ev.events = epollFlags(events);
+    ev.data.fd = fd;
+
+    int op = EPOLL_CTL_ADD;
+    if (_fdHandlers.find(fd) != _fdHandlers.end()) {
+        op = EPOLL_CTL_MOD;
+    }
+
+    if (::epoll_ctl(_epollFd, op, fd, &ev) < 0) {
+        // a closed descriptor drops out of the epoll set silently, so a
+        // re-used fd number can legitimately be unknown to the kernel
+        if ((op != EPOLL_CTL_MOD) || (errno != ENOENT) ||
+            (::epoll_ctl(_epollFd, EPOLL_CTL_ADD, fd, &ev) < 0))
+        {
+            perror("epoll_ctl failed adding descriptor");
+            return;
+        }
+    }
+
+    _fdHandlers[fd] = std::make_shared<Watch>(Watch{events, handler});
+}
+
+void EventLoop::removeFd(int fd)
+{
+    if (_fdHandlers.erase(fd) == 0) {
+        return;
+    }
+
+    // fails harmlessly if the descriptor was already closed
+    ::epoll_ctl(_epollFd, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+EventLoop::TimerId EventLoop::addTimer(microseconds interval, TimerHandler handler, bool repeat)
+{
+    const int fd = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0) {
+        perror("timerfd_create failed");
+        exit(1);
+    }
+
+    // an all-zero it_value would disarm the timer
+    const int64_t usec = std::max(interval.count(), static_cast<int64_t>(1));
+    struct itimerspec spec = {};
+    spec.it_value.tv_sec = usec / 1000000;
+    spec.it_value.tv_nsec = (usec % 1000000) * 1000;
+    if (repeat) {
+        spec.it_interval = spec.it_value;
+    }
+
+    if (::timerfd_settime(fd, 0, &spec, nullptr) < 0) {
+        perror("timerfd_settime failed");
+        exit(1);
+    }
+
+    auto t = std::make_shared<Timer>();
+    t->handler = handler;
+    t->repeat = repeat;
+    _timers[fd] = t;
+
+    addFd(fd, Readable, [this, fd](unsigned int) {
+        uint64_t expirations = 0;
+        if ((::read(fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+            || (expirations == 0))
+        {
+            return;
+        }
+
+        auto it = _timers.find(fd);
+        if (it == _timers.end()) {
+            return;
+        }
+
+        std::shared_ptr<Timer> timer = it->second;
+        if (!timer->repeat) {
+            cancelTimer(fd);
+        }
+
+        timer->handler(expirations);
+    });
+
+    return fd;
+}
+
+void EventLoop::cancelTimer(TimerId id)
+{
+    if (_timers.erase(id) == 0) {
+        return;
+    }
+
+    removeFd(id);
+    ::close(id);
+}
+
+void EventLoop::setTimerInterval(TimerId id, microseconds interval)
+{
+    if (_timers.find(id) == _timers.end()) {
+        return;
+    }
+
+    const int64_t usec = std::max(interval.count(), static_cast<int64_t>(1));
+    struct itimerspec spec = {};
+    spec.it_value.tv_sec = usec / 1000000;
+    spec.it_value.tv_nsec = (usec % 1000000) * 1000;
+    spec.it_interval = spec.it_value;
+    if (::timerfd_settime(id, 0, &spec, nullptr) < 0) {
+        perror("timerfd_settime failed");
+    }
+}
+
+void EventLoop::runOnce(int timeoutMsec)
+{
+    struct epoll_event events[32];
+    const int count = ::epoll_wait(_epollFd, events, 32, timeoutMsec);
+    if (count < 0) {
+        if (errno != EINTR) {
+            perror("epoll_wait failed");
+        }
+        return;
+    }
+
+    for (int i=0; i<count; ++i) {
+        const uint32_t e = events[i].events;
+        unsigned int flags = 0;
+        if (e & EPOLLIN) flags |= Readable;
+        if (e & EPOLLOUT) flags |= Writable;
+        if (e & EPOLLPRI) flags |= Priority;
+        if (e & (EPOLLERR | EPOLLHUP)) flags |= Error;
+        dispatchFd(events[i].data.fd, flags);
+    }
+}
+
+#else // of Linux implementation
+
+EventLoop::EventLoop()
+{
+    addFd(_wakeup.fd(), Readable, [this](unsigned int) {
+        _wakeup.drain();
+    });
+}
+
+EventLoop::~EventLoop()
+{
+}
+
+void EventLoop::addFd(int fd, unsigned int events, FdHandler handler)
+{
+    _fdHandlers[fd] = std::make_shared<Watch>(Watch{events, handler});
+}
+
+void EventLoop::removeFd(int fd)
+{
+    _fdHandlers.erase(fd);
+}
+
+EventLoop::TimerId EventLoop::addTimer(microseconds interval, TimerHandler handler, bool repeat)
+{
+    auto t = std::make_shared<Timer>();
+    t->handler = handler;
+    t->repeat = repeat;
+    t->interval = std::max(interval, microseconds(1));
+    t->deadline = steady_clock::now() + t->interval;
+
+    const TimerId id = _nextTimerId++;
+    _timers[id] = t;
+    return id;
+}
+
+void EventLoop::cancelTimer(TimerId id)
+{
+    _timers.erase(id);
+}
+
+void EventLoop::setTimerInterval(TimerId id, microseconds interval)
+{
+    auto it = _timers.find(id);
+    if (it == _timers.end()) {
+        return;
+    }
+
+    it->second->interval = std::max(interval, microseconds(1));
+    it->second->deadline = steady_clock::now() + it->second->interval;
+}
+
+void EventLoop::runOnce(int timeoutMsec)
+{
+    auto now = steady_clock::now();
+    for (auto& t : _timers) {
+        const auto untilDeadline = duration_cast<milliseconds>(t.second->deadline - now).count() + 1;
+        const int msec = static_cast<int>(std::max(untilDeadline, static_cast<int64_t>(0)));
+        if ((timeoutMsec < 0) || (msec < timeoutMsec)) {
+            timeoutMsec = msec;
+        }
+    }
+
+    std::vector<struct pollfd> fds;
+    for (auto& h : _fdHandlers) {
+        const unsigned int events = h.second->events;
+        struct pollfd p = {h.first, 0, 0};
+        if (events & Readable) p.events |= POLLIN;
+        if (events & Writable) p.events |= POLLOUT;
+        if (events & Priority) p.events |= POLLPRI;
+        fds.push_back(p);
+    }
+
+    const int count = ::poll(fds.data(), fds.size(), timeoutMsec);
+    if (count < 0) {
+        if (errno != EINTR) {
+            perror("poll failed");
+        }
+        return;
+    }
+
+    for (const auto& p : fds) {
+        if (p.revents == 0) {
+            continue;
+        }
+
+        unsigned int flags = 0;
+        if (p.revents & POLLIN) flags |= Readable;
+        if (p.revents & POLLOUT) flags |= Writable;
+        if (p.revents & POLLPRI) flags |= Priority;
+        if (p.revents & (POLLERR | POLLHUP | POLLNVAL)) flags |= Error;
+        dispatchFd(p.fd, flags);
+    }
+
+    now = steady_clock::now();
+    std::vector<TimerId> due;
+    for (auto& t : _timers) {
+        if (t.second->deadline <= now) {
+            due.push_back(t.first);
+        }
+    }
+
+    for (auto id : due) {
+        auto it = _timers.find(id);
+        if (it == _timers.end()) {
+            continue; // cancelled by an earlier timer
+        }
+
+        std::shared_ptr<Timer> timer = it->second;
+        uint64_t expirations = 1;
+        if (timer->repeat) {
+            expirations += (now - timer->deadline) / timer->interval;
+            timer->deadline += timer->interval * expirations;
+        } else {
+            _timers.erase(it);
+        }
+
+        timer->handler(expirations);
+    }
+}
+
+#endif
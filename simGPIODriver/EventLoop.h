@@ -0,0 +1,97 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <functional>
+#include <memory>
+#include <map>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// cross-thread wakeup: an eventfd on Linux, a self-pipe elsewhere. notify()
+// is safe to call from any thread, or from a signal handler.
+class EventNotifier
+{
+public:
+    EventNotifier();
+    ~EventNotifier();
+
+    int fd() const
+    {
+        return _fds[0];
+    }
+
+    void notify();
+
+    // consume pending notifications, so fd() is no longer readable
+    void drain();
+private:
+    int _fds[2] = {-1, -1};
+};
+
+// Small reactor shared by the drivers: epoll for descriptors, timerfd for
+// periodic work and an eventfd to break out of the wait. On non-Linux
+// builds the same interface is provided on top of poll().
+class EventLoop
+{
+public:
+    enum EventFlags
+    {
+        Readable = 1 << 0,
+        Writable = 1 << 1,
+        Priority = 1 << 2, // sysfs GPIO edges are signalled this way
+        Error = 1 << 3
+    };
+
+    using FdHandler = std::function<void(unsigned int events)>;
+
+    // expirations is normally 1; larger values mean the loop missed
+    // deadlines and the timer fired more than once since last serviced.
+    using TimerHandler = std::function<void(uint64_t expirations)>;
+    using TimerId = int;
+
+    EventLoop();
+    ~EventLoop();
+
+    void addFd(int fd, unsigned int events, FdHandler handler);
+    void removeFd(int fd);
+
+    // timers run on CLOCK_MONOTONIC. A zero interval fires on the next
+    // iteration of the loop.
+    TimerId addTimer(std::chrono::microseconds interval, TimerHandler handler, bool repeat = true);
+    void cancelTimer(TimerId id);
+
+    // change a repeating timer's interval; the next expiry is one new
+    // interval from now
+    void setTimerInterval(TimerId id, std::chrono::microseconds interval);
+
+    // wait for at most timeoutMsec (-1 = forever) and dispatch whatever
+    // became ready
+    void runOnce(int timeoutMsec = -1);
+
+    // dispatch until quit() is called
+    void run();
+
+    // safe from other threads and signal handlers
+    void quit();
+private:
+    struct Watch
+    {
+        unsigned int events;
+        FdHandler handler;
+    };
+
+    struct Timer;
+
+    void dispatchFd(int fd, unsigned int events);
+
+    std::map<int, std::shared_ptr<Watch>> _fdHandlers;
+    std::map<TimerId, std::shared_ptr<Timer>> _timers;
+    std::atomic<bool> _quit{false};
+    EventNotifier _wakeup;
+
+    int _epollFd = -1;
+    TimerId _nextTimerId = 1; // only used by the poll() implementation
+};
+
+#endif
@@ -4,10 +4,12 @@
 #include <cstdio>
 #include <cstring>
 #include <exception>
+#include <chrono>
 
 #include <errno.h>
 #include <netdb.h> // for gethostbyname
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
@@ -206,6 +208,11 @@ bool FGFSTelnetSocket::connect(const std::string &host, const int port)
         return false;
     }
 
+    // every write is one or more complete lines; don't let Nagle hold a
+    // batch of gets back behind the subscribes written just before it
+    int noDelay = 1;
+    ::setsockopt(_rawSocket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
     _connected = true;
     return write("data");
 }
@@ -264,6 +271,10 @@ bool FGFSTelnetSocket::poll(LineHandler handler, int timeoutMsec)
     tv.tv_usec = microSecs % 1000000;
 
     int readyFDs = ::select(FD_SETSIZE, &readFDs, nullptr, &errorFDs, &tv);
+    if ((readyFDs < 0) && (errno == EINTR)) {
+        return true;
+    }
+
     if (readyFDs < 0) {
         perror("Select failed doing poll()");
         _connected = false;
@@ -285,23 +296,40 @@ bool FGFSTelnetSocket::poll(LineHandler handler, int timeoutMsec)
     }
 
     if (FD_ISSET(_rawSocket, &readFDs)) {
-        std::string buf;
-        buf.resize(bufferLength);
-
-        int len = ::read(_rawSocket, (void*) buf.data(), bufferLength - 1);
-        if (len < 0) {
-            std::cerr << "reading from socket failed" << std::endl;
-            _connected = false;
-            close();
-            return false;
+        return readAvailable(handler);
+    }
+
+    return true;
+}
+
+bool FGFSTelnetSocket::readAvailable(LineHandler handler)
+{
+    std::string buf;
+    buf.resize(bufferLength);
+
+    int len = ::read(_rawSocket, (void*) buf.data(), bufferLength - 1);
+    if (len < 0) {
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) {
+            return true;
         }
 
-        buf.resize(len); // trunate to what we actually got
-        buf.insert(0, _residualBytes); // prepend our residual
-        _residualBytes.clear();
-        processReadLines(buf, handler);
+        std::cerr << "reading from socket failed" << std::endl;
+        _connected = false;
+        close();
+        return false;
     }
 
+    if (len == 0) {
+        std::cerr << "saw close of the socket" << std::endl;
+        _connected = false;
+        close();
+        return false;
+    }
+
+    buf.resize(len); // trunate to what we actually got
+    buf.insert(0, _residualBytes); // prepend our residual
+    _residualBytes.clear();
+    processReadLines(buf, handler);
     return true;
 }
 
@@ -357,15 +385,98 @@ bool FGFSTelnetSocket::syncGetBool(const std::string& path, bool& result)
         result = (line == "true") || (line == "1");
         ok = true;
     }, 1000);
-    
+    return ok;
+}
+
 
+bool FGFSTelnetSocket::syncGetString(const std::string& path, std::string& result)
+{
+    write("get " + path);
+    bool ok = false;
+
+    poll([&result, &ok](const std::string& line) {
+        result = line;
+        ok = true;
+    }, 1000);
     return ok;
 }
 
+// replies to our own requests are bare values; subscription updates are
+// "path=value", subscribe requests are acknowledged by name and the
+// keepalive "pwd" is answered with a bare "/"
+static bool isNotification(const std::string& line)
+{
+    return ((line.size() > 1) && (line[0] == '/') && (line.find('=') != std::string::npos))
+        || (line == "/")
+        || (line.compare(0, 9, "subscribe") == 0) || (line.compare(0, 11, "unsubscribe") == 0);
+}
+
+bool FGFSTelnetSocket::syncGetMany(const std::vector<std::string>& paths, std::vector<std::string>& values,
+                                   LineHandler others, int timeoutMsec)
+{
+    values.clear();
+    if (paths.empty()) {
+        return true;
+    }
+
+    std::vector<std::string> requests;
+    for (const auto& p : paths) {
+        requests.push_back("get " + p);
+    }
+
+    if (!writeLines(requests)) {
+        return false;
+    }
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMsec);
+    while (values.size() < paths.size()) {
+        const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        if (remaining <= 0) {
+            return false;
+        }
+
+        const bool ok = poll([&values, &paths, &others](const std::string& line) {
+            if ((values.size() < paths.size()) && !isNotification(line)) {
+                values.push_back(line);
+            } else {
+                others(line);
+            }
+        }, static_cast<int>(remaining));
+
+        if (!ok || !_connected) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool FGFSTelnetSocket::writeLines(const std::vector<std::string>& lines)
+{
+    std::string buf;
+    for (const auto& l : lines) {
+        buf += l;
+        buf += "\015\012";
+    }
+
+    return buf.empty() || writeRaw(buf.data(), buf.size());
+}
 
 bool FGFSTelnetSocket::write(const std::string &msg)
 {
     char buf[bufferLength];
+    strcpy(buf, msg.c_str());
+    strcat(buf, "\015\012");
+    return writeRaw(buf, strlen(buf));
+}
+
+bool FGFSTelnetSocket::writeRaw(const char* bytes, size_t length)
+{
+    if (!_connected) {
+        // input events can arrive while we are disconnected
+        return false;
+    }
+
     fd_set fd;
     struct timeval tv;
 
@@ -378,9 +489,7 @@ bool FGFSTelnetSocket::write(const std::string &msg)
         return false;
     }
 
-    strcpy(buf, msg.c_str());
-    strcat(buf, "\015\012");
-    int len = ::write(_rawSocket, buf, strlen(buf));
+    int len = ::write(_rawSocket, bytes, length);
     if (len < 0) {
         perror("socket write failed, closing");
         _connected = false; // don't re-enter write()
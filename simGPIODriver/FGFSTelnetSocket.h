@@ -2,6 +2,7 @@
 #define FGFS_TELNET_SOCKET_H
 
 #include <string>
+#include <vector>
 #include <functional>
 
 class FGFSTelnetSocket
@@ -13,6 +14,15 @@ public:
 
     bool poll(LineHandler handler, int timeoutMsec = 0);
 
+    // read whatever is available without waiting, for use when an event
+    // loop has reported fd() as readable. Returns false if the socket closed.
+    bool readAvailable(LineHandler handler);
+
+    int fd() const
+    {
+        return _rawSocket;
+    }
+
     bool isConnected() const;
 
     void close();
@@ -25,9 +35,23 @@ public:
 
     bool syncGetBool(const std::string& path, bool& result);
 
+    bool syncGetString(const std::string& path, std::string& result);
+
+    // pipelined gets: every request in one write, then the replies
+    // collected in order. Property updates arriving meanwhile are passed
+    // to <others>.
+    bool syncGetMany(const std::vector<std::string>& paths, std::vector<std::string>& values,
+                     LineHandler others, int timeoutMsec = 1000);
+
     void processReadLines(const std::string& buf, LineHandler handler);
 
     bool write(const std::string& msg);
+
+    // send bytes already formatted as command lines, CR/LF included
+    bool writeRaw(const char* bytes, size_t length);
+
+    // several commands in a single write
+    bool writeLines(const std::vector<std::string>& lines);
 private:
     bool checkForClose();
 
@@ -1,78 +1,408 @@
 #include "GPIO.h"
 
+#include <algorithm>
 
-#if defined(LINUX_BUILD)
 extern "C" {
   #include "ABE_IoPi.h"
 }
-#else
-#include "dummy_IoPi.h"
-#endif
+
+#include "I2CBus.h"
 
 void GPIOPoller::open()
 {
+    I2CBusSelection bus(_bus);
     IOPi_init(_address); // initialise one of the io pi buses on i2c address 0x20
     set_port_direction(_address, 0, _portInputMask[0]);
     set_port_direction(_address, 1, _portInputMask[1]);
     set_port_pullups(_address, 0, _portInputMask[0]);
     set_port_pullups(_address, 1, _portInputMask[1]);
-    updateOutputs();
 }
 
-void GPIOPoller::addOutput(OutputBindingRef b)
+void GPIOPoller::enableInterrupts()
 {
-    assert(b);
-    _outputs.push_back(b);
-    UpdateCallback cb = std::bind(std::mem_fn(&GPIOPoller::markOutputDirty), this, b->port());
-    b->setCallback(cb);
-    _portOutputMask[b->port()] |= 1 << b->bit();
-    _portOutputsDirty[b->port()] = true;
+    I2CBusSelection bus(_bus);
+    mirror_interrupts(_address, 1); // either pin signals both ports
+    set_interrupt_type(_address, 0, 0x00); // compare against previous value
+    set_interrupt_type(_address, 1, 0x00);
+    set_interrupt_on_port(_address, 0, _portInputMask[0]);
+    set_interrupt_on_port(_address, 1, _portInputMask[1]);
+    reset_interrupts(_address);
 }
 
-void GPIOPoller::update()
+uint16_t GPIOPoller::readInputs()
 {
-    const uint8_t inPins0 = read_port(_address, 0);
-    const uint8_t inPins1 = read_port(_address, 1);
+    I2CBusSelection bus(_bus);
+    const uint8_t port0 = read_port(_address, 0);
+    const uint8_t port1 = read_port(_address, 1);
+    return (port1 << 8) | port0;
+}
 
-    if (inPins0 != _portStates[0]) {
-        _portStates[0] = inPins0;
+void GPIOPoller::writePort(uint8_t port, uint8_t value)
+{
+    I2CBusSelection bus(_bus);
+    write_port(_address, port, value);
+}
 
-        for (auto& b : _bindings) {
-            if (b.port() == 0) {
-                b.update(inPins0);
-            }
+GPIOBank::GPIOBank()
+{
+    for (auto& chip : _outputShadow) {
+        chip[0] = 0;
+        chip[1] = 0;
+    }
+}
+
+GPIOPoller& GPIOBank::addChip(uint8_t address, int bus)
+{
+    assert(_chips.size() < MaxInputChips);
+    assert(chipIndex(address) < 0);
+
+    const unsigned int index = _chips.size();
+    _chips.emplace_back(new GPIOPoller{address, bus});
+
+    auto it = std::find_if(_groups.begin(), _groups.end(), [bus](const std::unique_ptr<ScanGroup>& g) {
+        return g->bus == bus;
+    });
+    if (it == _groups.end()) {
+        _groups.emplace_back(new ScanGroup);
+        _groups.back()->bus = bus;
+        it = _groups.end() - 1;
+    }
+
+    (*it)->chips.push_back(index);
+    (*it)->mask |= InputWord{0xffff} << (index * 16);
+    updateSettleThresholds(**it);
+    return *_chips.back();
+}
+
+std::vector<int> GPIOBank::buses() const
+{
+    std::vector<int> result;
+    for (const auto& g : _groups) {
+        result.push_back(g->bus);
+    }
+    return result;
+}
+
+GPIOBank::ScanGroup& GPIOBank::group(int bus)
+{
+    for (auto& g : _groups) {
+        if (g->bus == bus) {
+            return *g;
         }
     }
 
-    if (inPins1 != _portStates[1]) {
-        _portStates[1] = inPins1;
+    assert(false && "no chips on that bus");
+    return *_groups.front();
+}
 
-        for (auto& b : _bindings) {
-            if (b.port() == 1) {
-                b.update(inPins1);
-            }
+const GPIOBank::ScanGroup& GPIOBank::group(int bus) const
+{
+    return const_cast<GPIOBank*>(this)->group(bus);
+}
+
+int GPIOBank::chipIndex(uint8_t address) const
+{
+    for (unsigned int i=0; i < _chips.size(); ++i) {
+        if (_chips[i]->address() == address) {
+            return i;
         }
     }
 
-    updateOutputs();
+    return -1;
+}
+
+GPIOPoller& GPIOBank::chip(uint8_t address)
+{
+    const int index = chipIndex(address);
+    assert(index >= 0);
+    return *_chips[index];
+}
+
+unsigned int GPIOBank::addInput(uint8_t address, uint8_t port, uint8_t bit)
+{
+    const int index = chipIndex(address);
+    assert(index >= 0);
+    assert(port < 2);
+    assert(bit < 8);
+
+    const unsigned int b = bitIndex(index, port, bit);
+    _plainInputMask |= InputWord{1} << b;
+    return b;
+}
+
+void GPIOBank::setDefaultSettleTime(std::chrono::microseconds settle)
+{
+    _defaultSettle = settle;
+    for (auto& g : _groups) {
+        updateSettleThresholds(*g);
+    }
+}
+
+void GPIOBank::setSettleTime(uint8_t address, uint8_t port, uint8_t bit, std::chrono::microseconds settle)
+{
+    const int index = chipIndex(address);
+    assert(index >= 0);
+    const unsigned int b = bitIndex(index, port, bit);
+    _settle[b] = settle;
+    _settleSet[b] = true;
+    updateSettleThresholds(group(_chips[index]->bus()));
 }
 
-void GPIOPoller::updateOutputs()
+void GPIOBank::setScanPeriod(int bus, std::chrono::nanoseconds period)
 {
-    for (int port=0; port < 2; ++port) {
-        if (!_portOutputsDirty[port]) {
+    ScanGroup& g = group(bus);
+    g.scanPeriod = period;
+    updateSettleThresholds(g);
+}
+
+void GPIOBank::updateSettleThresholds(ScanGroup& g)
+{
+    const unsigned int maxCount = (1 << CounterBits) - 1;
+    const int64_t period = g.scanPeriod.count();
+    for (auto& t : g.threshold) {
+        t = 0;
+    }
+
+    for (unsigned int b=0; b < InputWordBits; ++b) {
+        if (!((g.mask >> b) & 1)) {
             continue;
         }
 
-        _portOutputsDirty[port] = false;
-        uint8_t value = 0;
+        const auto settle = _settleSet[b] ? _settle[b] : _defaultSettle;
+        // round up: the level must hold for at least the settle time. A
+        // count of one accepts the first differing sample, i.e. no filter.
+        const int64_t samples = 1 + (std::chrono::nanoseconds(settle).count() + period - 1) / period;
+        const unsigned int count = std::min<int64_t>(samples, maxCount);
+        for (unsigned int k=0; k < CounterBits; ++k) {
+            if (count & (1 << k)) {
+                g.threshold[k] |= InputWord{1} << b;
+            }
+        }
+    }
+}
+
+InputWord GPIOBank::debounce(ScanGroup& g, InputWord raw)
+{
+    if (!g.haveSample) {
+        g.debounced = raw;
+        g.haveSample = true;
+        return raw;
+    }
+
+    const InputWord differs = raw ^ g.debounced;
+
+    InputWord pending = 0;
+    for (auto c : g.count) {
+        pending |= c;
+    }
+
+    // pins that had started counting but went back: a suppressed bounce
+    const InputWord bounced = pending & ~differs;
+    if (bounced) {
+        _suppressedBounces.fetch_add(__builtin_popcountll(bounced), std::memory_order_relaxed);
+    }
+
+    // increment the counters of differing pins, clear the rest
+    InputWord carry = differs;
+    for (auto& c : g.count) {
+        const InputWord next = (c ^ carry) & differs;
+        carry &= c;
+        c = next;
+    }
+
+    // pins whose count reached their threshold take the new level
+    InputWord mismatch = 0;
+    for (unsigned int k=0; k < CounterBits; ++k) {
+        mismatch |= g.count[k] ^ g.threshold[k];
+    }
+    const InputWord settled = differs & ~mismatch;
+
+    g.debounced ^= settled;
+    for (auto& c : g.count) {
+        c &= ~settled;
+    }
+
+    return g.debounced;
+}
 
-        for (auto& b : _outputs) {
-            if ((b->port() == port) && b->state()) {
-                value |= 1 << b->bit();
+OutputPin GPIOBank::addOutput(uint8_t address, uint8_t port, uint8_t bit)
+{
+    const int index = chipIndex(address);
+    assert(index >= 0);
+    assert(port < 2);
+    assert(bit < 8);
+
+    _outputMask[index][port] |= 1 << bit;
+    return OutputPin{static_cast<uint8_t>(index), port, bit};
+}
+
+bool GPIOBank::readGroup(const ScanGroup& g, InputWord& word)
+{
+    static_assert(MaxInputChips <= IOPI_MAX_MULTI_READ, "too many chips for one transaction");
+
+    // one combined transaction for every chip on the bus: a single bus
+    // acquisition and syscall per scan instead of four separate
+    // open/write/read/close sequences per chip
+    char addresses[MaxInputChips];
+    unsigned char values[MaxInputChips * 2];
+    for (unsigned int i=0; i < g.chips.size(); ++i) {
+        addresses[i] = _chips[g.chips[i]]->address();
+    }
+
+    I2CBusSelection bus(g.bus);
+    if (read_ports_multi(addresses, g.chips.size(), values) < 0) {
+        return false;
+    }
+
+    word = 0;
+    for (unsigned int i=0; i < g.chips.size(); ++i) {
+        const uint16_t ports = (values[i * 2 + 1] << 8) | values[i * 2];
+        word |= static_cast<InputWord>(ports) << (g.chips[i] * 16);
+    }
+
+    return true;
+}
+
+bool GPIOBank::readAll(InputWord& word)
+{
+    word = 0;
+    for (const auto& g : _groups) {
+        InputWord w;
+        if (!readGroup(*g, w)) {
+            return false;
+        }
+        word |= w;
+    }
+
+    return true;
+}
+
+void GPIOBank::open()
+{
+    // every pin that isn't a lamp is an input, bound or not, so bindings
+    // can change later without reconfiguring the chips
+    _inputMask = 0;
+    for (unsigned int i=0; i < _chips.size(); ++i) {
+        const uint16_t outputs = (_outputMask[i][1] << 8) | _outputMask[i][0];
+        const InputWord plain = _plainInputMask >> (i * 16);
+        assert((plain & outputs) == 0);
+        (void) plain;
+
+        const uint16_t chipInputs = ~outputs;
+        _inputMask |= static_cast<InputWord>(chipInputs) << (i * 16);
+
+        _chips[i]->setInputMask(0, chipInputs & 0xff);
+        _chips[i]->setInputMask(1, chipInputs >> 8);
+        _chips[i]->open();
+    }
+
+    for (auto& g : _groups) {
+        flushOutputs(*g, true);
+    }
+}
+
+void GPIOBank::flushOutputs(ScanGroup& g, bool force)
+{
+    for (unsigned int i : g.chips) {
+        for (uint8_t port = 0; port < 2; ++port) {
+            if (_outputMask[i][port] == 0) {
+                continue;
             }
+
+            const uint8_t value = _outputShadow[i][port].load(std::memory_order_relaxed);
+            if (!force && (value == _outputWritten[i][port])) {
+                continue;
+            }
+
+            _chips[i]->writePort(port, value);
+            _outputWritten[i][port] = value;
         }
+    }
+}
+
+void GPIOBank::enableInterrupts()
+{
+    for (auto& c : _chips) {
+        c->enableInterrupts();
+    }
+}
+
+unsigned int GPIOBank::scan(int bus, InputEventQueue& events, bool* activity)
+{
+    ScanGroup& g = group(bus);
+    const auto sampleTime = ScanClock::now();
+
+    InputWord word;
+    if (!readGroup(g, word)) {
+        // keep the previous state rather than reporting spurious edges
+        g.readErrors.fetch_add(1, std::memory_order_relaxed);
+        flushOutputs(g, false);
+        return 0;
+    }
+    word &= _inputMask; // output pins read back their latch
+    if (activity) {
+        InputWord settling = 0;
+        for (auto c : g.count) {
+            settling |= c;
+        }
+        *activity = (word != g.lastRaw) || settling;
+    }
+    g.lastRaw = word;
+    word = debounce(g, word);
+
+    // merge this bus's chips into the shared snapshot
+    InputWord state = _state.load(std::memory_order_relaxed);
+    while (!_state.compare_exchange_weak(state, (state & ~g.mask) | word, std::memory_order_release)) {
+    }
+
+    // only edges somebody is listening for
+    const InputWord changed = word ^ g.lastWord;
+    const InputWord rising = _watchedRising.load(std::memory_order_relaxed);
+    const InputWord falling = _watchedFalling.load(std::memory_order_relaxed);
+    InputWord edges = changed & ((word & rising) | (~word & falling));
+    g.lastWord = word;
+
+    unsigned int count = 0;
+    while (edges) {
+        const uint8_t bit = __builtin_ctzll(edges);
+        edges &= edges - 1; // clear lowest set bit
+
+        const bool s = (word >> bit) & 1;
+        if (events.push(InputEvent{bit, s, sampleTime})) {
+            ++count;
+        } else {
+            g.droppedEvents.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    flushOutputs(g, false);
+    return count;
+}
+
+uint32_t GPIOBank::droppedEvents() const
+{
+    uint32_t total = 0;
+    for (const auto& g : _groups) {
+        total += g->droppedEvents.load(std::memory_order_relaxed);
+    }
+    return total;
+}
 
-        write_port(_address, port, value);
-    } // of port iteration
+uint32_t GPIOBank::droppedEvents(int bus) const
+{
+    return group(bus).droppedEvents.load(std::memory_order_relaxed);
+}
+
+uint32_t GPIOBank::readErrors() const
+{
+    uint32_t total = 0;
+    for (const auto& g : _groups) {
+        total += g->readErrors.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+uint32_t GPIOBank::readErrors(int bus) const
+{
+    return group(bus).readErrors.load(std::memory_order_relaxed);
 }
@@ -2,13 +2,20 @@
 #define GPIO_H
 
 #include <vector>
-#include <functional>
 #include <cstdint>
 #include <memory>
 #include <cassert>
+#include <atomic>
+#include <chrono>
 
-using Callback = std::function<void(bool)>;
-using UpdateCallback = std::function<void(void)>;
+#include "SPSCQueue.h"
+
+using ScanClock = std::chrono::steady_clock;
+
+// every expander input pin in one word: bit = chip * 16 + port * 8 + pin
+using InputWord = uint64_t;
+const unsigned int MaxInputChips = sizeof(InputWord) * 8 / 16;
+const unsigned int InputWordBits = MaxInputChips * 16;
 
 enum class Trigger
 {
@@ -17,32 +24,32 @@ enum class Trigger
     Low,
 };
 
-class InputBinding
+// an output lamp is just its location; the state lives in the bank's
+// shadow registers
+struct OutputPin
 {
-public:
-    InputBinding(uint8_t addr, uint8_t port, uint8_t bit, Callback cb, Trigger t = Trigger::AnyEdge) :
-        _address(addr),
-        _port(port),
-        _bit(bit),
-        _trigger(t),
-        _callback(cb)
-    {
+    uint8_t chip; // index within the GPIOBank
+    uint8_t port;
+    uint8_t bit;
+};
 
-    }
+struct InputEvent
+{
+    uint8_t bit; // index into the InputWord
+    bool state;
+    ScanClock::time_point sampleTime;
+};
 
-    void update(uint8_t val)
+using InputEventQueue = SPSCQueue<InputEvent, 256>;
+
+// one MCP23017: pin directions and raw port access
+class GPIOPoller
+{
+public:
+    GPIOPoller(uint8_t addr, int bus = 1) :
+        _address(addr),
+        _bus(bus)
     {
-        const uint8_t mask = (1 << _bit);
-        const bool s = (val & mask);
-        if (s != _lastState) {
-            if ((_trigger == Trigger::AnyEdge)
-                || (_trigger == Trigger::High && s)
-                || (_trigger == Trigger::Low && !s))
-            {
-                _callback(s);
-            }
-            _lastState = s;
-        }
     }
 
     uint8_t address() const
@@ -50,115 +57,184 @@ public:
         return _address;
     }
 
-    uint8_t port() const
+    // the /dev/i2c-<n> adapter the chip is wired to
+    int bus() const
     {
-        return _port;
+        return _bus;
     }
 
-    uint8_t bit() const
+    void setInputMask(uint8_t port, uint8_t mask)
     {
-        return _bit;
+        assert(port < 2);
+        _portInputMask[port] = mask;
     }
-private:
-    const uint8_t _address;
-    const uint8_t _port;
-    const uint8_t _bit;
 
-    Trigger _trigger = Trigger::AnyEdge;
-    bool _lastState = false;
+    void open();
+
+    // raise INTA/INTB on any change of an input pin
+    void enableInterrupts();
+
+    // both ports, port 1 in the high byte. GPIOBank::scan() reads every
+    // chip in one transaction instead; this is the per-port path.
+    uint16_t readInputs();
 
-    Callback _callback;
+    void writePort(uint8_t port, uint8_t value);
+private:
+    const uint8_t _address;
+    const int _bus;
+    uint8_t _portInputMask[2] = {0,0};
 };
 
-class OutputBinding
+// All expander chips, with their inputs combined into a single InputWord.
+// Edges are found by XOR against the previous scan and only the watched
+// ones are queued, so the cost scales with the number of edges rather
+// than the number of bindings; the caller dispatches them, e.g. through a
+// BindingSet.
+//
+// Chips on different I2C buses are scanned independently, one scanner per
+// bus, each updating its own chips' bits of the shared snapshot.
+class GPIOBank
 {
 public:
-    OutputBinding(uint8_t port, uint8_t bit) :
-        _port(port),
-        _bit (bit)
-    {
+    GPIOBank();
 
-    }
+    // chips are assigned InputWord positions in the order they are added.
+    // Addresses must be unique across buses.
+    GPIOPoller& addChip(uint8_t address, int bus = 1);
 
-    void setState(bool b)
-    {
-        if (b == _state)
-            return;
-        _state = b;
-        if (_changedCallback) {
-            _changedCallback();
-        }
-    }
+    // every bus with at least one chip, in the order first used
+    std::vector<int> buses() const;
 
-    uint8_t port() const
-    {
-        return _port;
-    }
+    GPIOPoller& chip(uint8_t address);
 
-    uint8_t bit() const
+    // queue events for these edges. Replaces the previous set, and may be
+    // called while scanning.
+    void setWatchedEdges(InputWord rising, InputWord falling)
     {
-        return _bit;
+        _watchedRising.store(rising, std::memory_order_relaxed);
+        _watchedFalling.store(falling, std::memory_order_relaxed);
     }
 
-    bool state() const
+    // Debouncing: a pin must read its new level on this much consecutive
+    // scan time before the change is accepted. Zero disables it for the
+    // pin; the longest usable settle is 15 scans.
+    void setDefaultSettleTime(std::chrono::microseconds settle);
+    void setSettleTime(uint8_t address, uint8_t port, uint8_t bit, std::chrono::microseconds settle);
+
+    // a bus scanner's sample interval, used to turn settle times into
+    // sample counts. Call from that scanning thread (or before it starts).
+    void setScanPeriod(int bus, std::chrono::nanoseconds period);
+
+    // an input without watched edges, read from snapshot() or by a
+    // scan observer such as an encoder. Returns its InputWord bit.
+    unsigned int addInput(uint8_t address, uint8_t port, uint8_t bit);
+
+    OutputPin addOutput(uint8_t address, uint8_t port, uint8_t bit);
+
+    // any thread; the scanner writes the port when the shadow differs
+    // from what the chip was last sent
+    void setOutput(OutputPin pin, bool on)
     {
-        return _state;
+        std::atomic<uint8_t>& shadow = _outputShadow[pin.chip][pin.port];
+        const uint8_t mask = 1 << pin.bit;
+        if (on) {
+            shadow.fetch_or(mask, std::memory_order_relaxed);
+        } else {
+            shadow.fetch_and(~mask, std::memory_order_relaxed);
+        }
     }
 
-    void setCallback(UpdateCallback cb)
+    bool output(OutputPin pin) const
     {
-        _changedCallback = cb;
+        return _outputShadow[pin.chip][pin.port].load(std::memory_order_relaxed) & (1 << pin.bit);
     }
-private:
-    bool _state = false;
-    UpdateCallback _changedCallback;
-    const uint8_t _port;
-    const uint8_t _bit;
-};
 
-using OutputBindingRef = std::shared_ptr<OutputBinding>;
-using InputBindingVec = std::vector<InputBinding>;
-using OutputBindingVec = std::vector<OutputBindingRef>;
+    void open();
 
-class GPIOPoller
-{
-public:
-    GPIOPoller(uint8_t addr) :
-        _address(addr)
-    {
+    void enableInterrupts();
 
-    }
+    // scanner thread for <bus>: sample its chips, queue an event per
+    // watched edge and flush any changed outputs on that bus. Returns the
+    // number of events queued. <activity> is set when any input moved
+    // since the previous sample or is still settling.
+    unsigned int scan(int bus, InputEventQueue& events, bool* activity = nullptr);
 
-    void addBinding(const InputBinding& b)
+    // whole-panel input state as of the last scan
+    InputWord snapshot() const
     {
-        assert(b.address() == _address);
-        _bindings.push_back(b);
-        _portInputMask[b.port()] |= 1 << b.bit();
+        return _state.load(std::memory_order_acquire);
     }
 
-    void addOutput(OutputBindingRef b);
-
-    void open();
+    static constexpr unsigned int bitIndex(unsigned int chipIndex, uint8_t port, uint8_t bit)
+    {
+        return (chipIndex * 16) + (port * 8) + bit;
+    }
 
-    void update();
-private:
-    void updateOutputs();
+    // totals, or for the chips on one bus
+    uint32_t droppedEvents() const;
+    uint32_t droppedEvents(int bus) const;
+    uint32_t readErrors() const;
+    uint32_t readErrors(int bus) const;
 
-    void markOutputDirty(uint8_t port)
+    // level changes that reverted before their settle time ran out
+    uint64_t suppressedBounces() const
     {
-        assert(port < 2);
-        _portOutputsDirty[port] = true;
+        return _suppressedBounces.load(std::memory_order_relaxed);
     }
 
-    const uint8_t _address;
-    uint8_t _portStates[2] = {0,0};
-    uint8_t _portInputMask[2] = {0,0};
-    uint8_t _portOutputMask[2] = {0,0};
+    // sample every chip, one combined I2C transaction per bus
+    bool readAll(InputWord& word);
+private:
+    static const unsigned int CounterBits = 4;
 
-    bool _portOutputsDirty[2] = {false, false};
-    InputBindingVec _bindings;
-    OutputBindingVec _outputs;
+    // the chips on one bus and the scan state their scanner owns
+    struct ScanGroup
+    {
+        int bus;
+        std::vector<unsigned int> chips; // indices into _chips
+        InputWord mask = 0; // every bit of those chips
+        InputWord lastWord = 0;
+        InputWord lastRaw = 0;
+
+        // vertical counters: bit n of count[k] is bit k of pin n's count
+        // of consecutive samples disagreeing with the debounced level,
+        // and threshold[] holds each pin's settle count the same way
+        InputWord count[CounterBits] = {};
+        InputWord threshold[CounterBits] = {};
+        InputWord debounced = 0;
+        bool haveSample = false;
+        std::chrono::nanoseconds scanPeriod{std::chrono::milliseconds(2)};
+
+        std::atomic<uint32_t> droppedEvents{0};
+        std::atomic<uint32_t> readErrors{0};
+    };
+
+    int chipIndex(uint8_t address) const;
+    ScanGroup& group(int bus);
+    const ScanGroup& group(int bus) const;
+
+    bool readGroup(const ScanGroup& g, InputWord& word);
+    void flushOutputs(ScanGroup& g, bool force);
+    InputWord debounce(ScanGroup& g, InputWord raw);
+    void updateSettleThresholds(ScanGroup& g);
+
+    std::vector<std::unique_ptr<GPIOPoller>> _chips;
+    std::vector<std::unique_ptr<ScanGroup>> _groups;
+
+    InputWord _inputMask = 0;
+    InputWord _plainInputMask = 0; // inputs from addInput()
+    std::atomic<InputWord> _watchedRising{0};
+    std::atomic<InputWord> _watchedFalling{0};
+    std::atomic<InputWord> _state{0};
+    std::atomic<uint64_t> _suppressedBounces{0};
+
+    std::chrono::microseconds _defaultSettle{0};
+    std::chrono::microseconds _settle[InputWordBits];
+    bool _settleSet[InputWordBits] = {};
+
+    uint8_t _outputMask[MaxInputChips][2] = {};
+    std::atomic<uint8_t> _outputShadow[MaxInputChips][2];
+    uint8_t _outputWritten[MaxInputChips][2] = {}; // only touched by the chip's scanner
 };
 
-
 #endif
@@ -0,0 +1,245 @@
+#include "GPIOScanner.h"
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstdio>
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+using namespace std::chrono;
+
+GPIOScanner::GPIOScanner(GPIOBank& bank, int bus, unsigned int rateHz) :
+    _bank(bank),
+    _bus(bus),
+    _period(nanoseconds(1000000000 / std::max(rateHz, 1u))),
+    _idlePeriod(_period)
+{
+    _bank.setScanPeriod(_bus, _period);
+}
+
+void* GPIOScanner::operator new(size_t size)
+{
+    void* p = nullptr;
+    if (::posix_memalign(&p, alignof(GPIOScanner), size) != 0) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void GPIOScanner::operator delete(void* p)
+{
+    ::free(p);
+}
+
+void GPIOScanner::setIdlePolicy(unsigned int idleHz, milliseconds hold)
+{
+    _idlePeriod = std::max(_period, nanoseconds(1000000000 / std::max(idleHz, 1u)));
+    _hold = hold;
+}
+
+GPIOScanner::~GPIOScanner()
+{
+    stop();
+    for (int fd : _interruptFds) {
+        ::close(fd);
+    }
+}
+
+static bool writeSysfs(const std::string& path, const std::string& value)
+{
+    std::ofstream f(path);
+    f << value;
+    return f.good();
+}
+
+bool GPIOScanner::addInterruptLine(int gpioPin)
+{
+    const std::string pin = std::to_string(gpioPin);
+    const std::string dir = "/sys/class/gpio/gpio" + pin;
+
+    if (::access(dir.c_str(), F_OK) != 0) {
+        writeSysfs("/sys/class/gpio/export", pin);
+    }
+
+    // the expanders are configured for active-high interrupt outputs
+    if (!writeSysfs(dir + "/direction", "in") || !writeSysfs(dir + "/edge", "rising")) {
+        std::cerr << "failed to configure interrupt GPIO " << gpioPin << std::endl;
+        return false;
+    }
+
+    const int fd = ::open((dir + "/value").c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror("failed to open interrupt GPIO value");
+        return false;
+    }
+
+    _bank.enableInterrupts();
+
+    _interruptFds.push_back(fd);
+    _loop.addFd(fd, EventLoop::Priority, [this, fd](unsigned int) {
+        // re-arm: sysfs requires the value to be read back after each edge
+        char buf[8];
+        ::lseek(fd, 0, SEEK_SET);
+        (void) ::read(fd, buf, sizeof(buf));
+
+        _interruptCount.fetch_add(1, std::memory_order_relaxed);
+        scan();
+    });
+
+    return true;
+}
+
+void GPIOScanner::start()
+{
+    if (_running) {
+        return;
+    }
+
+    _lastActivity = ScanClock::now();
+    _timer = _loop.addTimer(duration_cast<microseconds>(_period), [this](uint64_t expirations) {
+        if (expirations > 1) {
+            // the bus was slower than the requested rate; timerfd skips the
+            // missed deadlines rather than bursting to catch up
+            _overrunCount.fetch_add(expirations - 1, std::memory_order_relaxed);
+        }
+
+        scan();
+    });
+
+    _statsStart = ScanClock::now();
+    _running = true;
+    _thread = std::thread(&EventLoop::run, &_loop);
+}
+
+void GPIOScanner::stop()
+{
+    if (!_running) {
+        return;
+    }
+
+    _loop.quit();
+    _thread.join();
+    _running = false;
+}
+
+static int64_t threadCpuNsec()
+{
+    struct timespec ts;
+    ::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// charge the wall and CPU time since the last call to the current state
+void GPIOScanner::account(ScanClock::time_point now)
+{
+    const int64_t cpu = threadCpuNsec();
+    if (_accountedCpuNsec >= 0) {
+        StateStats& st = _stateStats[static_cast<int>(_state)];
+        st.wallNsec.fetch_add(duration_cast<nanoseconds>(now - _accountedTime).count(), std::memory_order_relaxed);
+        st.cpuNsec.fetch_add(cpu - _accountedCpuNsec, std::memory_order_relaxed);
+    }
+
+    _accountedTime = now;
+    _accountedCpuNsec = cpu;
+}
+
+void GPIOScanner::setState(ScanState state)
+{
+    account(ScanClock::now());
+    _state = state;
+    _stateChanges.fetch_add(1, std::memory_order_relaxed);
+
+    const nanoseconds period = (state == ScanState::Active) ? _period : _idlePeriod;
+    _bank.setScanPeriod(_bus, period);
+    _loop.setTimerInterval(_timer, duration_cast<microseconds>(period));
+}
+
+void GPIOScanner::scan()
+{
+    const auto scanStart = ScanClock::now();
+    account(scanStart);
+
+    bool activity = false;
+    const unsigned int queued = _bank.scan(_bus, _events, &activity);
+
+    if (!_encoders.empty()) {
+        const InputWord word = _bank.snapshot();
+        for (QuadratureEncoder* e : _encoders) {
+            e->sample(word, scanStart);
+        }
+    }
+
+    if (queued > 0) {
+        _notifier.notify();
+    }
+
+    const int64_t scanNsec = duration_cast<nanoseconds>(ScanClock::now() - scanStart).count();
+    if (scanNsec > _maxScanNsec.load(std::memory_order_relaxed)) {
+        _maxScanNsec.store(scanNsec, std::memory_order_relaxed);
+    }
+    _scanCount.fetch_add(1, std::memory_order_relaxed);
+    _stateStats[static_cast<int>(_state)].scans.fetch_add(1, std::memory_order_relaxed);
+
+    if (activity) {
+        _lastActivity = scanStart;
+    }
+
+    if (_idlePeriod > _period) {
+        if ((_state == ScanState::Idle) && activity) {
+            setState(ScanState::Active);
+        } else if ((_state == ScanState::Active) && (scanStart - _lastActivity >= _hold)) {
+            setState(ScanState::Idle);
+        }
+    }
+}
+
+void GPIOScanner::printStats(std::ostream& os)
+{
+    const auto now = ScanClock::now();
+    const double elapsed = duration_cast<duration<double>>(now - _statsStart).count();
+    const uint64_t scans = _scanCount.exchange(0);
+    // an edge arriving while idle waits up to a full idle period
+    const double periodMsec = duration_cast<duration<double, std::milli>>(_idlePeriod).count();
+
+    const uint32_t dropped = _bank.droppedEvents(_bus);
+
+    // worst case from a contact changing to its callback running is one
+    // full scan period (edge just after a sample) plus the measured
+    // sample-to-dispatch latency.
+    os << "GPIO scan (i2c-" << _bus << "): " << (scans / elapsed) << " Hz"
+       << ", max scan " << (_maxScanNsec.exchange(0) / 1000) << " usec"
+       << ", overruns " << _overrunCount.exchange(0)
+       << ", interrupts " << _interruptCount.exchange(0)
+       << ", events " << _dispatchCount
+       << ", dropped " << dropped
+       << ", read errors " << _bank.readErrors(_bus)
+       << ", bounces suppressed " << _bank.suppressedBounces()
+       << ", max sample->dispatch " << (_maxLatencyNsec / 1000) << " usec"
+       << ", worst-case input latency " << (periodMsec + _maxLatencyNsec / 1e6) << " msec"
+       << std::endl;
+
+    static const char* stateNames[] = {"active", "idle"};
+    os << "  scan states (" << _stateChanges.exchange(0) << " changes):";
+    for (int i = 0; i < 2; ++i) {
+        StateStats& st = _stateStats[i];
+        const uint64_t stateScans = st.scans.exchange(0);
+        const double wall = st.wallNsec.exchange(0) / 1e9;
+        const double cpu = st.cpuNsec.exchange(0) / 1e9;
+        os << " " << stateNames[i] << " " << (100.0 * wall / elapsed) << "% of time";
+        if (wall > 0) {
+            os << " at " << (stateScans / wall) << " Hz, CPU " << (100.0 * cpu / wall) << "%";
+        }
+        os << (i == 0 ? ";" : "");
+    }
+    os << std::endl;
+
+    _statsStart = now;
+    _dispatchCount = 0;
+    _maxLatencyNsec = 0;
+}
@@ -0,0 +1,144 @@
+#ifndef GPIO_SCANNER_H
+#define GPIO_SCANNER_H
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <ostream>
+
+#include "GPIO.h"
+#include "EventLoop.h"
+#include "Encoder.h"
+
+// Runs GPIOBank::scan() on a dedicated thread at a fixed rate, independent
+// of the telnet socket. Input events are handed to the network thread
+// through a lock-free queue; the scanner signals wakeFd() whenever it
+// queues something, so the network side can wait on it.
+//
+// Each scanner covers the bank's chips on one I2C bus; with expanders
+// spread over several buses, run one scanner per bus so a slow or
+// retrying bus doesn't hold up the others.
+//
+// The scan rate adapts to the panel: the full rate while inputs are
+// moving, dropping to an idle rate once nothing has changed for a hold
+// time, which leaves the bus and CPU mostly quiet between switch presses.
+class GPIOScanner
+{
+public:
+    enum class ScanState
+    {
+        Active,
+        Idle
+    };
+
+    GPIOScanner(GPIOBank& bank, int bus, unsigned int rateHz);
+    ~GPIOScanner();
+
+    // the event queue's indices sit on their own cache lines, an
+    // alignment plain operator new doesn't honour before C++17
+    static void* operator new(size_t size);
+    static void operator delete(void* p);
+
+    // scan immediately when a Pi GPIO wired to the expanders' INTA/INTB
+    // pins goes high, instead of waiting for the next timer tick. Call
+    // before start().
+    bool addInterruptLine(int gpioPin);
+
+    int bus() const
+    {
+        return _bus;
+    }
+
+    // scan at idleHz after <hold> without input activity; the first
+    // change seen switches back to the full rate. An idle rate at or above
+    // the full rate keeps the scan rate fixed. Call before start().
+    void setIdlePolicy(unsigned int idleHz, std::chrono::milliseconds hold);
+
+    // decode on every scan; call before start()
+    void addEncoder(QuadratureEncoder* encoder)
+    {
+        _encoders.push_back(encoder);
+    }
+
+    void start();
+    void stop();
+
+    // readable when events are pending
+    int wakeFd() const
+    {
+        return _notifier.fd();
+    }
+
+    // hand every queued event to <handler>, on the calling thread
+    template <typename Handler>
+    unsigned int dispatchPending(Handler&& handler)
+    {
+        _notifier.drain();
+
+        unsigned int count = 0;
+        InputEvent ev;
+        while (_events.pop(ev)) {
+            const int64_t latency = std::chrono::duration_cast<std::chrono::nanoseconds>(ScanClock::now() - ev.sampleTime).count();
+            if (latency > _maxLatencyNsec) {
+                _maxLatencyNsec = latency;
+            }
+            handler(ev);
+            ++count;
+        }
+
+        _dispatchCount += count;
+        return count;
+    }
+
+    void printStats(std::ostream& os);
+private:
+    void scan();
+    void setState(ScanState state);
+    void account(ScanClock::time_point now);
+
+    GPIOBank& _bank;
+    const int _bus;
+    std::chrono::nanoseconds _period;
+    std::chrono::nanoseconds _idlePeriod;
+    std::chrono::milliseconds _hold{2000};
+    std::thread _thread;
+    bool _running = false;
+    EventLoop::TimerId _timer = 0;
+
+    // owned by the scan thread
+    ScanState _state = ScanState::Active;
+    ScanClock::time_point _lastActivity;
+    ScanClock::time_point _accountedTime;
+    int64_t _accountedCpuNsec = -1;
+
+    struct StateStats
+    {
+        std::atomic<uint64_t> scans{0};
+        std::atomic<int64_t> wallNsec{0};
+        std::atomic<int64_t> cpuNsec{0};
+    };
+
+    StateStats _stateStats[2];
+    std::atomic<uint64_t> _stateChanges{0};
+
+    EventLoop _loop; // owned by the scan thread once started
+    EventNotifier _notifier;
+    std::vector<int> _interruptFds;
+
+    InputEventQueue _events;
+    std::vector<QuadratureEncoder*> _encoders;
+
+    // written by the scan thread
+    std::atomic<uint64_t> _scanCount{0};
+    std::atomic<uint64_t> _overrunCount{0};
+    std::atomic<uint64_t> _interruptCount{0};
+    std::atomic<int64_t> _maxScanNsec{0};
+
+    // written by the dispatching thread
+    int64_t _maxLatencyNsec = 0;
+    uint64_t _dispatchCount = 0;
+    ScanClock::time_point _statsStart;
+};
+
+#endif
@@ -0,0 +1,332 @@
+#include "GaugeCalibration.h"
+
+#include <cassert>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+
+#include "JSON.h"
+
+GaugeCurve::GaugeCurve(const std::string& name, uint8_t channel, std::vector<Point> points) :
+    _name(name),
+    _channel(channel),
+    _points(std::move(points))
+{
+    assert(_points.size() >= 2);
+    buildTable();
+}
+
+void GaugeCurve::setCount(size_t point, uint16_t count)
+{
+    _points.at(point).count = count;
+    buildTable();
+}
+
+void GaugeCurve::setProperty(const std::string& path, double min, double max)
+{
+    assert(max > min);
+    _property = path;
+    _min = min;
+    _max = max;
+    _scale = 1.0 / (max - min);
+}
+
+void GaugeCurve::buildTable()
+{
+    _table.resize(TableSize);
+    size_t segment = 0;
+    for (unsigned int i = 0; i < TableSize; ++i) {
+        const double v = static_cast<double>(i) / (TableSize - 1);
+        while ((segment + 2 < _points.size()) && (v > _points[segment + 1].value)) {
+            ++segment;
+        }
+
+        const Point& a = _points[segment];
+        const Point& b = _points[segment + 1];
+        double count;
+        if (v <= a.value) {
+            count = a.count;
+        } else if (v >= b.value) {
+            count = b.count;
+        } else {
+            count = a.count + (v - a.value) / (b.value - a.value) * (b.count - a.count);
+        }
+        _table[i] = static_cast<uint16_t>(std::lround(count));
+    }
+}
+
+GaugeCalibration GaugeCalibration::builtin()
+{
+    // flap-pos-norm moves in equal steps between the 737 detents
+    const char* labels[] = {"UP", "1", "2", "5", "10", "15", "25", "30", "40"};
+    const uint16_t counts[] = {150, 200, 240, 280, 320, 370, 405, 440, 480};
+
+    std::vector<GaugeCurve::Point> points;
+    for (unsigned int i = 0; i < 9; ++i) {
+        points.push_back(GaugeCurve::Point{labels[i], i / 8.0, counts[i]});
+    }
+
+    GaugeCalibration result;
+    GaugeCurve flaps("flaps", 0, std::move(points));
+    flaps.setProperty("/surface-positions/flap-pos-norm");
+    result.add(std::move(flaps));
+    return result;
+}
+
+bool GaugeCalibration::loadJSON(const std::string& path, std::string& error)
+{
+    JSONValue doc;
+    if (!JSONValue::parseFile(path, doc, error)) {
+        return false;
+    }
+
+    const JSONValue* gauges = doc.isObject() ? doc.find("gauges") : nullptr;
+    if (!gauges || !gauges->isArray()) {
+        error = path + ": expected an object with a \"gauges\" array";
+        return false;
+    }
+
+    std::vector<GaugeCurve> curves;
+    for (const JSONValue& g : gauges->array()) {
+        std::ostringstream prefix;
+        prefix << path << ":" << g.line() << ": ";
+
+        const JSONValue* name = g.find("name");
+        const JSONValue* detents = g.find("detents");
+        if (!name || !name->isString() || !detents || !detents->isArray()) {
+            error = prefix.str() + "gauge needs a \"name\" and \"detents\"";
+            return false;
+        }
+
+        const JSONValue* channel = g.find("channel");
+        if (!channel || !channel->isNumber() || (channel->number() < 0) || (channel->number() > 15)) {
+            error = prefix.str() + "channel must be 0-15";
+            return false;
+        }
+
+        std::vector<GaugeCurve::Point> points;
+        for (const JSONValue& d : detents->array()) {
+            const JSONValue* label = d.find("label");
+            const JSONValue* value = d.find("value");
+            const JSONValue* count = d.find("count");
+            if (!value || !value->isNumber() || !count || !count->isNumber()) {
+                error = prefix.str() + "detent needs a \"value\" and \"count\"";
+                return false;
+            }
+
+            const double v = value->number();
+            if ((v < 0.0) || (v > 1.0) || (!points.empty() && (v <= points.back().value))) {
+                error = prefix.str() + "detent values must ascend within 0-1";
+                return false;
+            }
+            if ((count->number() < 0) || (count->number() > 4095)) {
+                error = prefix.str() + "count must be 0-4095";
+                return false;
+            }
+
+            points.push_back(GaugeCurve::Point{(label && label->isString()) ? label->string() : "",
+                                               v, static_cast<uint16_t>(count->number())});
+        }
+
+        if (points.size() < 2) {
+            error = prefix.str() + "gauge needs at least two detents";
+            return false;
+        }
+
+        const uint8_t c = static_cast<uint8_t>(channel->number());
+        for (const GaugeCurve& other : curves) {
+            if (other.channel() == c) {
+                error = prefix.str() + "channel already used by " + other.name();
+                return false;
+            }
+        }
+
+        GaugeCurve curve(name->string(), c, std::move(points));
+
+        const JSONValue* property = g.find("property");
+        const JSONValue* min = g.find("min");
+        const JSONValue* max = g.find("max");
+        const JSONValue* slew = g.find("slew");
+        if ((property && !property->isString()) || (min && !min->isNumber()) || (max && !max->isNumber()) ||
+            (slew && (!slew->isNumber() || (slew->number() <= 0.0))))
+        {
+            error = prefix.str() + "\"property\" must be a string, \"min\", \"max\" and \"slew\" numbers";
+            return false;
+        }
+
+        if (property) {
+            const double lo = min ? min->number() : 0.0;
+            const double hi = max ? max->number() : 1.0;
+            if (hi <= lo) {
+                error = prefix.str() + "\"max\" must be above \"min\"";
+                return false;
+            }
+            curve.setProperty(property->string(), lo, hi);
+        }
+        if (slew) {
+            curve.setSlew(slew->number());
+        }
+
+        curves.push_back(std::move(curve));
+    }
+
+    // only replace the curves once the whole file is good
+    std::vector<StepperGaugeConfig> stepperConfigs;
+    const JSONValue* steppers = doc.find("steppers");
+    if (steppers && !loadSteppers(*steppers, path, stepperConfigs, error)) {
+        return false;
+    }
+
+    _curves = std::move(curves);
+    _steppers = std::move(stepperConfigs);
+    return true;
+}
+
+bool GaugeCalibration::loadSteppers(const JSONValue& steppers, const std::string& path,
+                                    std::vector<StepperGaugeConfig>& result, std::string& error)
+{
+    if (!steppers.isArray()) {
+        error = path + ": \"steppers\" must be an array";
+        return false;
+    }
+
+    uint16_t used = 0; // channels, four per stepper
+    for (const JSONValue& s : steppers.array()) {
+        std::ostringstream prefix;
+        prefix << path << ":" << s.line() << ": ";
+
+        const JSONValue* name = s.find("name");
+        const JSONValue* property = s.find("property");
+        const JSONValue* channel = s.find("channel");
+        if (!name || !name->isString() || !property || !property->isString() || !channel || !channel->isNumber()) {
+            error = prefix.str() + "stepper needs a \"name\", \"channel\" and \"property\"";
+            return false;
+        }
+
+        if ((channel->number() < 0) || (channel->number() > 12)) {
+            error = prefix.str() + "stepper channel must be 0-12, it uses four";
+            return false;
+        }
+
+        StepperGaugeConfig config;
+        config.name = name->string();
+        config.channel = static_cast<uint8_t>(channel->number());
+        config.property = property->string();
+
+        const uint16_t channels = 0xf << config.channel;
+        if (used & channels) {
+            error = prefix.str() + "channels overlap another stepper";
+            return false;
+        }
+        used |= channels;
+
+        const std::pair<const char*, double*> numbers[] = {
+            {"min", &config.min}, {"max", &config.max}, {"degrees", &config.degrees},
+            {"maxSpeed", &config.maxSpeed}, {"acceleration", &config.acceleration}};
+        for (const auto& n : numbers) {
+            if (const JSONValue* v = s.find(n.first)) {
+                if (!v->isNumber()) {
+                    error = prefix.str() + "\"" + n.first + "\" must be a number";
+                    return false;
+                }
+                *n.second = v->number();
+            }
+        }
+
+        if ((config.max <= config.min) || (config.degrees <= 0.0) || (config.maxSpeed <= 0.0) ||
+            (config.acceleration <= 0.0))
+        {
+            error = prefix.str() + "\"max\" must be above \"min\", and the sweep and speeds positive";
+            return false;
+        }
+
+        result.push_back(config);
+    }
+
+    return true;
+}
+
+static std::string quoted(const std::string& s)
+{
+    std::string result = "\"";
+    for (char c : s) {
+        if ((c == '"') || (c == '\\')) {
+            result += '\\';
+        }
+        result += c;
+    }
+    return result + "\"";
+}
+
+bool GaugeCalibration::saveJSON(const std::string& path, std::string& error) const
+{
+    // write a temporary and rename it, so an interrupted calibration
+    // never leaves a truncated file behind
+    const std::string temp = path + ".tmp";
+    {
+        std::ofstream f(temp);
+        f << "{\n    \"gauges\": [";
+        for (size_t g = 0; g < _curves.size(); ++g) {
+            const GaugeCurve& curve = _curves[g];
+            f << (g ? ",\n" : "\n") << "        {\n"
+              << "            \"name\": " << quoted(curve.name()) << ",\n"
+              << "            \"channel\": " << int(curve.channel()) << ",\n";
+            if (!curve.property().empty()) {
+                f << "            \"property\": " << quoted(curve.property()) << ",\n"
+                  << "            \"min\": " << curve.min() << ",\n"
+                  << "            \"max\": " << curve.max() << ",\n";
+            }
+            f << "            \"slew\": " << curve.slew() << ",\n"
+              << "            \"detents\": [";
+            for (size_t p = 0; p < curve.points().size(); ++p) {
+                const GaugeCurve::Point& point = curve.points()[p];
+                f << (p ? ",\n" : "\n")
+                  << "                {\"label\": " << quoted(point.label) << ", \"value\": " << point.value
+                  << ", \"count\": " << point.count << "}";
+            }
+            f << "\n            ]\n        }";
+        }
+        f << "\n    ]";
+
+        if (!_steppers.empty()) {
+            f << ",\n    \"steppers\": [";
+            for (size_t s = 0; s < _steppers.size(); ++s) {
+                const StepperGaugeConfig& config = _steppers[s];
+                f << (s ? ",\n" : "\n") << "        {\n"
+                  << "            \"name\": " << quoted(config.name) << ",\n"
+                  << "            \"channel\": " << int(config.channel) << ",\n"
+                  << "            \"property\": " << quoted(config.property) << ",\n"
+                  << "            \"min\": " << config.min << ",\n"
+                  << "            \"max\": " << config.max << ",\n"
+                  << "            \"degrees\": " << config.degrees << ",\n"
+                  << "            \"maxSpeed\": " << config.maxSpeed << ",\n"
+                  << "            \"acceleration\": " << config.acceleration << "\n"
+                  << "        }";
+            }
+            f << "\n    ]";
+        }
+        f << "\n}\n";
+
+        if (!f.flush()) {
+            error = "failed to write " + temp;
+            return false;
+        }
+    }
+
+    if (::rename(temp.c_str(), path.c_str()) != 0) {
+        error = "failed to replace " + path;
+        return false;
+    }
+    return true;
+}
+
+const GaugeCurve* GaugeCalibration::find(const std::string& name) const
+{
+    for (const auto& c : _curves) {
+        if (c.name() == name) {
+            return &c;
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,166 @@
+#ifndef GAUGE_CALIBRATION_H
+#define GAUGE_CALIBRATION_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+class JSONValue;
+
+// A servo gauge's calibration: the PWM counts measured at its detents,
+// as values normalized to 0..1, joined by straight lines. The lines are
+// sampled into a dense table when the points change, so mapping a value
+// at runtime is one multiply and one table read. A gauge follows one
+// property, whose range from min to max is normalized first.
+class GaugeCurve
+{
+public:
+    struct Point
+    {
+        std::string label;
+        double value;
+        uint16_t count;
+    };
+
+    static const unsigned int TableSize = 1024;
+    static constexpr double DefaultSlew = 250.0; // counts per second
+
+    // <points> by ascending value, at least two
+    GaugeCurve(const std::string& name, uint8_t channel, std::vector<Point> points);
+
+    const std::string& name() const
+    {
+        return _name;
+    }
+
+    uint8_t channel() const
+    {
+        return _channel;
+    }
+
+    const std::vector<Point>& points() const
+    {
+        return _points;
+    }
+
+    void setProperty(const std::string& path, double min = 0.0, double max = 1.0);
+
+    const std::string& property() const
+    {
+        return _property;
+    }
+
+    double min() const
+    {
+        return _min;
+    }
+
+    double max() const
+    {
+        return _max;
+    }
+
+    // fastest the needle may move, in counts per second
+    double slew() const
+    {
+        return _slew;
+    }
+
+    void setSlew(double slew)
+    {
+        _slew = slew;
+    }
+
+    void setCount(size_t point, uint16_t count);
+
+    // values outside 0..1 (or NaN) clamp to the end counts
+    uint16_t count(double value) const
+    {
+        if (!(value > 0.0)) {
+            return _table.front();
+        }
+        if (value >= 1.0) {
+            return _table.back();
+        }
+        return _table[static_cast<unsigned int>(value * (TableSize - 1) + 0.5)];
+    }
+
+    // a raw property value
+    uint16_t countFor(double propertyValue) const
+    {
+        return count((propertyValue - _min) * _scale);
+    }
+private:
+    void buildTable();
+
+    std::string _name;
+    uint8_t _channel;
+    std::vector<Point> _points;
+    std::vector<uint16_t> _table;
+
+    std::string _property;
+    double _min = 0.0;
+    double _max = 1.0;
+    double _scale = 1.0;
+    double _slew = DefaultSlew;
+};
+
+// An X27-style stepper gauge on four channels of the stepper PCA9685,
+// from <channel>: coil A on the first pair, coil B on the second. The
+// needle is linear in degrees, so no detents are needed, only the sweep
+// the property's min..max maps onto.
+struct StepperGaugeConfig
+{
+    std::string name;
+    uint8_t channel = 0;
+    std::string property;
+    double min = 0.0;
+    double max = 1.0;
+    double degrees = 315.0; // the X27's full sweep
+    double maxSpeed = 180.0; // degrees per second
+    double acceleration = 1500.0; // degrees per second squared
+};
+
+// The curves of every servo gauge and the stepper gauges, persisted as
+// JSON:
+// {"gauges": [{"name", "channel", "property", "min", "max", "slew",
+//              "detents": [{"label", "value", "count"}]}],
+//  "steppers": [{"name", "channel", "property", "min", "max", "degrees",
+//                "maxSpeed", "acceleration"}]}
+// where only the names, channels, detents and stepper properties are
+// required.
+class GaugeCalibration
+{
+public:
+    // the flap gauge as measured on the 738 panel
+    static GaugeCalibration builtin();
+
+    bool loadJSON(const std::string& path, std::string& error);
+    bool saveJSON(const std::string& path, std::string& error) const;
+
+    void add(GaugeCurve curve)
+    {
+        _curves.push_back(std::move(curve));
+    }
+
+    // by name, or nullptr
+    const GaugeCurve* find(const std::string& name) const;
+
+    std::vector<GaugeCurve>& curves()
+    {
+        return _curves;
+    }
+
+    const std::vector<StepperGaugeConfig>& steppers() const
+    {
+        return _steppers;
+    }
+private:
+    bool loadSteppers(const JSONValue& steppers, const std::string& path,
+                      std::vector<StepperGaugeConfig>& result, std::string& error);
+
+    std::vector<GaugeCurve> _curves;
+    std::vector<StepperGaugeConfig> _steppers;
+};
+
+#endif
@@ -0,0 +1,71 @@
+#include "GaugeDriver.h"
+
+#include <cmath>
+#include <algorithm>
+
+#include "Adafruit_PWMServoDriver.h"
+
+using namespace std::chrono;
+
+// each tick covers this fraction of the remaining distance, so a needle
+// eases into its target instead of stopping dead at full slew
+const double ApproachFraction = 0.35;
+
+GaugeDriver::GaugeDriver(Adafruit_PWMServoDriver& servos, unsigned int rateHz) :
+    PWMTicker(servos, rateHz)
+{
+}
+
+GaugeDriver::~GaugeDriver()
+{
+    stop();
+}
+
+unsigned int GaugeDriver::addGauge(uint8_t channel, uint16_t initialCount, double slew)
+{
+    std::unique_ptr<Gauge> g(new Gauge);
+    g->channel = channel;
+    g->maxStep = slew * duration_cast<duration<double>>(_period).count();
+    g->target.store(initialCount);
+    g->position = initialCount;
+    _gauges.push_back(std::move(g));
+    return _gauges.size() - 1;
+}
+
+void GaugeDriver::tick(uint64_t)
+{
+    const auto start = steady_clock::now();
+
+    for (auto& g : _gauges) {
+        const double target = g->target.load(std::memory_order_relaxed);
+        const double remaining = target - g->position;
+        if (std::fabs(remaining) < 0.5) {
+            g->position = target;
+        } else {
+            const double step = remaining * ApproachFraction;
+            g->position += std::min(std::max(step, -g->maxStep), g->maxStep);
+        }
+
+        const int count = static_cast<int>(std::lround(g->position));
+        if (count == g->written) {
+            continue;
+        }
+
+        _chip.stagePWM(g->channel, 0, count);
+        g->written = count;
+    }
+
+    commitStaged();
+
+    const int64_t nsec = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+    if (nsec > _maxTickNsec.load(std::memory_order_relaxed)) {
+        _maxTickNsec.store(nsec, std::memory_order_relaxed);
+    }
+}
+
+void GaugeDriver::printStats(std::ostream& os)
+{
+    os << "Gauges: ";
+    printRates(os);
+    os << ", max tick " << (_maxTickNsec.exchange(0) / 1000) << " usec" << std::endl;
+}
@@ -0,0 +1,55 @@
+#ifndef GAUGE_DRIVER_H
+#define GAUGE_DRIVER_H
+
+#include <atomic>
+#include <ostream>
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+#include "PWMTicker.h"
+
+// Moves servo gauges on a PCA9685 from a dedicated thread at a fixed
+// rate. The network thread only posts targets, however irregularly they
+// arrive; each tick eases every gauge toward its latest target, limited
+// to its slew rate, and commits the channels whose count changed as one
+// auto-increment burst. I2C traffic is therefore at most one transaction
+// per tick, however many gauges move or how often their properties do.
+class GaugeDriver : public PWMTicker
+{
+public:
+    GaugeDriver(Adafruit_PWMServoDriver& servos, unsigned int rateHz = 50);
+    ~GaugeDriver() override;
+
+    // <slew> is the fastest the needle moves, in counts per second.
+    // Returns the gauge index. Call before start().
+    unsigned int addGauge(uint8_t channel, uint16_t initialCount, double slew);
+
+    // any thread
+    void setTarget(unsigned int gauge, uint16_t count)
+    {
+        _gauges[gauge]->target.store(count, std::memory_order_relaxed);
+    }
+
+    void printStats(std::ostream& os);
+private:
+    struct Gauge
+    {
+        uint8_t channel;
+        double maxStep; // counts per tick
+        std::atomic<uint16_t> target;
+
+        // owned by the drive thread
+        double position;
+        int written = -1; // the count last staged
+    };
+
+    void tick(uint64_t expirations) override;
+
+    std::vector<std::unique_ptr<Gauge>> _gauges;
+
+    // written by the drive thread
+    std::atomic<int64_t> _maxTickNsec{0};
+};
+
+#endif
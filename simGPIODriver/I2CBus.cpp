@@ -0,0 +1,474 @@
+#include "I2CBus.h"
+
+#include <map>
+#include <vector>
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+
+#include <errno.h>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#endif
+
+using namespace std::chrono;
+
+// a lamp or gauge request that has waited this long is served ahead of
+// newer inputs, so a busy input scan can't starve the outputs
+static const nanoseconds MaxQueueWait = milliseconds(10);
+
+static const microseconds RetryDelay(200);
+
+#if defined(__linux__)
+
+class LinuxI2CAdapter : public I2CAdapter
+{
+public:
+    LinuxI2CAdapter(int number)
+    {
+        const std::string path = "/dev/i2c-" + std::to_string(number);
+        _fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+        if (_fd < 0) {
+            std::cerr << "failed to open " << path << ": " << strerror(errno) << std::endl;
+        }
+    }
+
+    ~LinuxI2CAdapter()
+    {
+        if (_fd >= 0) {
+            ::close(_fd);
+        }
+    }
+
+    int transfer(I2CMessage* msgs, unsigned int count) override
+    {
+        if (_fd < 0) {
+            return ENODEV;
+        }
+
+        struct i2c_msg kmsgs[I2C_RDWR_IOCTL_MAX_MSGS];
+        assert(count <= I2C_RDWR_IOCTL_MAX_MSGS);
+        for (unsigned int i=0; i < count; ++i) {
+            kmsgs[i].addr = msgs[i].address;
+            kmsgs[i].flags = (msgs[i].flags & I2C_MSG_READ) ? I2C_M_RD : 0;
+            kmsgs[i].len = msgs[i].length;
+            kmsgs[i].buf = msgs[i].data;
+        }
+
+        struct i2c_rdwr_ioctl_data data;
+        data.msgs = kmsgs;
+        data.nmsgs = count;
+        if (::ioctl(_fd, I2C_RDWR, &data) < 0) {
+            return errno;
+        }
+
+        return 0;
+    }
+
+    unsigned int maxMessages() const override
+    {
+        return I2C_RDWR_IOCTL_MAX_MSGS;
+    }
+private:
+    int _fd = -1;
+};
+
+#endif
+
+// no bus on this platform: every transfer fails
+class NullI2CAdapter : public I2CAdapter
+{
+public:
+    int transfer(I2CMessage*, unsigned int) override
+    {
+        return ENODEV;
+    }
+
+    unsigned int maxMessages() const override
+    {
+        return 1;
+    }
+};
+
+static std::mutex registryMutex;
+static std::map<int, std::unique_ptr<I2CBus>> buses;
+
+I2CBus& I2CBus::get(int number)
+{
+    std::lock_guard<std::mutex> g(registryMutex);
+    auto it = buses.find(number);
+    if (it == buses.end()) {
+#if defined(__linux__)
+        std::unique_ptr<I2CAdapter> adapter(new LinuxI2CAdapter(number));
+#else
+        std::unique_ptr<I2CAdapter> adapter(new NullI2CAdapter);
+#endif
+        it = buses.emplace(number, std::unique_ptr<I2CBus>(new I2CBus(number, std::move(adapter)))).first;
+    }
+
+    return *it->second;
+}
+
+bool I2CBus::install(int number, std::unique_ptr<I2CAdapter> adapter)
+{
+    std::lock_guard<std::mutex> g(registryMutex);
+    if (buses.find(number) != buses.end()) {
+        return false;
+    }
+
+    buses.emplace(number, std::unique_ptr<I2CBus>(new I2CBus(number, std::move(adapter))));
+    return true;
+}
+
+I2CBus::I2CBus(int number, std::unique_ptr<I2CAdapter> adapter) :
+    _number(number),
+    _adapter(std::move(adapter)),
+    _statsStart(steady_clock::now())
+{
+    _thread = std::thread(&I2CBus::run, this);
+}
+
+I2CBus::~I2CBus()
+{
+    {
+        std::lock_guard<std::mutex> g(_mutex);
+        _quit = true;
+    }
+    _wake.notify_one();
+    _thread.join();
+}
+
+bool I2CBus::transfer(I2CPriority prio, I2CMessage* msgs, unsigned int count)
+{
+    if (count == 0) {
+        return true;
+    }
+
+    Request r;
+    r.msgs = msgs;
+    r.count = count;
+    r.priority = static_cast<unsigned int>(prio);
+    r.queued = steady_clock::now();
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _queues[r.priority].push_back(&r);
+    _wake.notify_one();
+    _completed.wait(lock, [&r]() { return r.done; });
+    return r.ok;
+}
+
+bool I2CBus::readRegisters(I2CPriority prio, uint8_t address, uint8_t reg, uint8_t* data, unsigned int length)
+{
+    I2CMessage msgs[2] = {
+        {address, 0, 1, &reg},
+        {address, I2C_MSG_READ, static_cast<unsigned short>(length), data}
+    };
+    return transfer(prio, msgs, 2);
+}
+
+bool I2CBus::writeRegisters(I2CPriority prio, uint8_t address, uint8_t reg, const uint8_t* data, unsigned int length)
+{
+    uint8_t buf[1 + 64]; // a full PCA9685 frame
+    assert(length < sizeof(buf));
+    buf[0] = reg;
+    memcpy(buf + 1, data, length);
+
+    I2CMessage msg = {address, 0, static_cast<unsigned short>(length + 1), buf};
+    return transfer(prio, &msg, 1);
+}
+
+I2CBus::Request* I2CBus::nextRequest()
+{
+    const auto now = steady_clock::now();
+
+    // overdue lamp or gauge requests first, then strictly by priority
+    for (unsigned int p = PriorityCount - 1; p > 0; --p) {
+        if (!_queues[p].empty() && (now - _queues[p].front()->queued) > MaxQueueWait) {
+            Request* r = _queues[p].front();
+            _queues[p].pop_front();
+            return r;
+        }
+    }
+
+    for (auto& q : _queues) {
+        if (!q.empty()) {
+            Request* r = q.front();
+            q.pop_front();
+            return r;
+        }
+    }
+
+    return nullptr;
+}
+
+void I2CBus::run()
+{
+    const unsigned int maxMessages = _adapter->maxMessages();
+    std::vector<Request*> batch;
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+        _wake.wait(lock, [this]() {
+            return _quit || !_queues[0].empty() || !_queues[1].empty() || !_queues[2].empty();
+        });
+
+        if (_quit) {
+            break;
+        }
+
+        // combine everything queued that fits into one adapter transfer
+        batch.clear();
+        unsigned int messages = 0;
+        const auto now = steady_clock::now();
+        while (Request* r = nextRequest()) {
+            if (!batch.empty() && (messages + r->count > maxMessages)) {
+                // doesn't fit: put it back for the next round
+                _queues[r->priority].push_front(r);
+                break;
+            }
+
+            const int64_t waited = duration_cast<nanoseconds>(now - r->queued).count();
+            _maxWaitNsec[r->priority] = std::max(_maxWaitNsec[r->priority], waited);
+            batch.push_back(r);
+            messages += r->count;
+        }
+
+        lock.unlock();
+        execute(batch.data(), batch.size());
+        lock.lock();
+
+        for (Request* r : batch) {
+            r->done = true;
+        }
+        ++_batches;
+        _completed.notify_all();
+    }
+}
+
+void I2CBus::execute(Request** batch, unsigned int size)
+{
+    if (size > 1) {
+        std::vector<I2CMessage> combined;
+        for (unsigned int i=0; i < size; ++i) {
+            combined.insert(combined.end(), batch[i]->msgs, batch[i]->msgs + batch[i]->count);
+        }
+
+        const auto start = steady_clock::now();
+        const int err = _adapter->transfer(combined.data(), combined.size());
+        account(combined.data(), combined.size(), start, duration_cast<nanoseconds>(steady_clock::now() - start).count(),
+                err, I2CTraceRecord::Batched);
+
+        if (err == 0) {
+            for (unsigned int i=0; i < size; ++i) {
+                batch[i]->ok = true;
+            }
+            return;
+        }
+
+        // something in the batch failed: redo each request on its own so
+        // only the faulty device sees the error
+    }
+
+    for (unsigned int i=0; i < size; ++i) {
+        batch[i]->ok = (attempt(batch[i]) == 0);
+    }
+}
+
+static bool isTransient(int err)
+{
+    // NAKs and arbitration problems from electrical noise come back as
+    // EREMOTEIO / EIO / EAGAIN; a missing adapter won't get better
+    return (err == EREMOTEIO) || (err == EIO) || (err == EAGAIN) || (err == ETIMEDOUT);
+}
+
+int I2CBus::attempt(Request* r)
+{
+    int err = 0;
+    for (unsigned int tries = 0; tries < MaxAttempts; ++tries) {
+        if (tries > 0) {
+            {
+                std::lock_guard<std::mutex> g(_mutex);
+                _devices[r->msgs[0].address & 0x7f].retries++;
+            }
+            std::this_thread::sleep_for(RetryDelay);
+        }
+
+        const auto start = steady_clock::now();
+        err = _adapter->transfer(r->msgs, r->count);
+        account(r->msgs, r->count, start, duration_cast<nanoseconds>(steady_clock::now() - start).count(),
+                err, (tries > 0) ? I2CTraceRecord::Retry : 0);
+
+        if ((err == 0) || !isTransient(err)) {
+            break;
+        }
+    }
+
+    if (err != 0) {
+        const uint8_t address = r->msgs[0].address & 0x7f;
+        std::lock_guard<std::mutex> g(_mutex);
+        if (_devices[address].errors++ == 0) {
+            // only the first, the rest show up in the stats
+            std::cerr << "I2C transfer to 0x" << std::hex << (int) address << std::dec
+                      << " failed: " << strerror(err) << std::endl;
+        }
+    }
+
+    return err;
+}
+
+static bool continuesTransaction(I2CMessage* msgs, unsigned int i)
+{
+    // a register-select write and the read following it are one
+    // transaction
+    return (msgs[i].flags & I2C_MSG_READ) && (i > 0) &&
+        !(msgs[i - 1].flags & I2C_MSG_READ) && (msgs[i - 1].address == msgs[i].address);
+}
+
+void I2CBus::account(I2CMessage* msgs, unsigned int count, steady_clock::time_point start,
+                     int64_t nsec, int err, uint8_t traceFlags)
+{
+    // split the bus time between devices by bytes on the wire, counting
+    // the address byte of each message
+    unsigned int total = 0;
+    for (unsigned int i=0; i < count; ++i) {
+        total += msgs[i].length + 1;
+    }
+
+    {
+        std::lock_guard<std::mutex> g(_mutex);
+        _busyNsec += nsec;
+        for (unsigned int i=0; i < count; ++i) {
+            DeviceStats& d = _devices[msgs[i].address & 0x7f];
+            d.busyNsec += (nsec * (msgs[i].length + 1)) / total;
+            if ((err == 0) && !continuesTransaction(msgs, i)) {
+                d.transactions++;
+            }
+            if (err == 0) {
+                d.bytes += msgs[i].length;
+            }
+        }
+    }
+
+    I2CTracer* tracer = _tracer.load(std::memory_order_acquire);
+    if (!tracer) {
+        return;
+    }
+
+    int64_t offset = std::max<int64_t>(duration_cast<nanoseconds>(start - _traceEpoch).count(), 0);
+    for (unsigned int i=0; i < count; ) {
+        I2CTraceRecord r;
+        r.address = msgs[i].address;
+        r.flags = traceFlags | (err ? I2CTraceRecord::Error : 0);
+
+        unsigned int wireBytes = msgs[i].length + 1;
+        if (msgs[i].flags & I2C_MSG_READ) {
+            r.reg = 0xff;
+            r.length = msgs[i].length;
+            r.flags |= I2CTraceRecord::Read;
+        } else {
+            r.reg = msgs[i].length ? msgs[i].data[0] : 0xff;
+            r.length = msgs[i].length ? msgs[i].length - 1 : 0;
+        }
+
+        for (++i; (i < count) && continuesTransaction(msgs, i); ++i) {
+            r.length += msgs[i].length;
+            r.flags |= I2CTraceRecord::Read;
+            wireBytes += msgs[i].length + 1;
+        }
+
+        const int64_t share = (nsec * wireBytes) / total;
+        r.startNsec = offset;
+        r.durationNsec = share;
+        tracer->record(r);
+        offset += share;
+    }
+}
+
+void I2CBus::startTrace(size_t capacity)
+{
+    std::lock_guard<std::mutex> g(_mutex);
+    if (_ownedTracer) {
+        return;
+    }
+
+    _traceEpoch = steady_clock::now();
+    _ownedTracer.reset(new I2CTracer(capacity));
+    _tracer.store(_ownedTracer.get(), std::memory_order_release);
+}
+
+void I2CBus::printStats(std::ostream& os)
+{
+    std::lock_guard<std::mutex> g(_mutex);
+    const auto now = steady_clock::now();
+    const double elapsed = duration_cast<duration<double>>(now - _statsStart).count();
+    const double elapsedNsec = elapsed * 1e9;
+
+    os << "I2C bus " << _number << ": occupancy " << std::fixed << std::setprecision(1) << (100.0 * _busyNsec / elapsedNsec) << "%"
+       << ", " << (_batches / elapsed) << " transfers/sec"
+       << ", max queue wait input/lamp/gauge "
+       << (_maxWaitNsec[0] / 1000) << "/" << (_maxWaitNsec[1] / 1000) << "/" << (_maxWaitNsec[2] / 1000) << " usec"
+       << std::endl;
+
+    for (unsigned int a = 0; a < 128; ++a) {
+        DeviceStats& d = _devices[a];
+        if ((d.transactions == 0) && (d.errors == 0)) {
+            continue;
+        }
+
+        os << "  0x" << std::hex << a << std::dec
+           << ": " << (d.transactions / elapsed) << " trans/sec"
+           << ", " << (d.bytes / elapsed) << " bytes/sec"
+           << ", utilization " << (100.0 * d.busyNsec / elapsedNsec) << "%"
+           << ", errors " << d.errors
+           << ", retries " << d.retries
+           << std::endl;
+        d = DeviceStats();
+    }
+
+    os.unsetf(std::ios::floatfield);
+    os << std::setprecision(6);
+
+    _busyNsec = 0;
+    _batches = 0;
+    for (auto& w : _maxWaitNsec) {
+        w = 0;
+    }
+    _statsStart = now;
+}
+
+// C interface for ABE_IoPi
+
+static thread_local int selectedBus = 1;
+
+void i2c_bus_select(int number)
+{
+    selectedBus = number;
+}
+
+int i2c_bus_selected(void)
+{
+    return selectedBus;
+}
+
+int i2c_bus_transfer(int priority, I2CMessage *msgs, int count)
+{
+    return I2CBus::get(selectedBus).transfer(static_cast<I2CPriority>(priority), msgs, count) ? 0 : -1;
+}
+
+int i2c_bus_read(int priority, unsigned char address, unsigned char reg, unsigned char *data, int length)
+{
+    return I2CBus::get(selectedBus).readRegisters(static_cast<I2CPriority>(priority), address, reg, data, length) ? 0 : -1;
+}
+
+int i2c_bus_write(int priority, unsigned char address, unsigned char reg, const unsigned char *data, int length)
+{
+    return I2CBus::get(selectedBus).writeRegisters(static_cast<I2CPriority>(priority), address, reg, data, length) ? 0 : -1;
+}
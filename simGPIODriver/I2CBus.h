@@ -0,0 +1,142 @@
+#ifndef I2C_BUS_H
+#define I2C_BUS_H
+
+#include <cstdint>
+#include <memory>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <ostream>
+#include <atomic>
+
+#include "I2CBusAPI.h"
+#include "I2CTrace.h"
+
+enum class I2CPriority
+{
+    Input = I2C_PRIORITY_INPUT,
+    Lamp = I2C_PRIORITY_LAMP,
+    Gauge = I2C_PRIORITY_GAUGE
+};
+
+// the hardware side of a bus: runs one combined transaction
+class I2CAdapter
+{
+public:
+    virtual ~I2CAdapter() = default;
+
+    // returns 0 or an errno value
+    virtual int transfer(I2CMessage* msgs, unsigned int count) = 0;
+
+    // most messages a single transfer() accepts
+    virtual unsigned int maxMessages() const = 0;
+};
+
+// Owns one I2C adapter. Every driver submits its transactions here; a
+// worker thread services them in priority order (inputs, then lamps,
+// then gauges), combines whatever is queued into as few adapter transfers
+// as possible and retries transient failures. Callers block until their
+// own transaction has completed.
+class I2CBus
+{
+public:
+    // the manager for /dev/i2c-<number>, created on first use
+    static I2CBus& get(int number = 1);
+
+    // use a different adapter, such as a VirtualI2CAdapter, for bus
+    // <number>. Fails if get() has already created it.
+    static bool install(int number, std::unique_ptr<I2CAdapter> adapter);
+
+    I2CBus(int number, std::unique_ptr<I2CAdapter> adapter);
+    ~I2CBus();
+
+    bool transfer(I2CPriority prio, I2CMessage* msgs, unsigned int count);
+
+    bool readRegisters(I2CPriority prio, uint8_t address, uint8_t reg, uint8_t* data, unsigned int length);
+    bool writeRegisters(I2CPriority prio, uint8_t address, uint8_t reg, const uint8_t* data, unsigned int length);
+
+    void printStats(std::ostream& os);
+
+    // record every transaction from now on; the most recent <capacity>
+    // are kept
+    void startTrace(size_t capacity = 65536);
+
+    // null until startTrace()
+    const I2CTracer* tracer() const
+    {
+        return _tracer.load(std::memory_order_acquire);
+    }
+private:
+    static const unsigned int PriorityCount = 3;
+    static const unsigned int MaxAttempts = 3;
+
+    struct Request
+    {
+        I2CMessage* msgs;
+        unsigned int count;
+        unsigned int priority;
+        std::chrono::steady_clock::time_point queued;
+        bool done = false;
+        bool ok = false;
+    };
+
+    struct DeviceStats
+    {
+        uint64_t transactions = 0;
+        uint64_t bytes = 0;
+        uint64_t errors = 0;
+        uint64_t retries = 0;
+        int64_t busyNsec = 0;
+    };
+
+    void run();
+    Request* nextRequest();
+    void execute(Request** batch, unsigned int size);
+    int attempt(Request* r);
+    void account(I2CMessage* msgs, unsigned int count, std::chrono::steady_clock::time_point start,
+                 int64_t nsec, int err, uint8_t traceFlags);
+
+    const int _number;
+    std::unique_ptr<I2CAdapter> _adapter;
+
+    std::mutex _mutex;
+    std::condition_variable _wake; // worker: work was queued
+    std::condition_variable _completed; // callers: a request finished
+    std::deque<Request*> _queues[PriorityCount];
+    bool _quit = false;
+    std::thread _thread;
+
+    // guarded by _mutex
+    DeviceStats _devices[128];
+    int64_t _busyNsec = 0;
+    int64_t _maxWaitNsec[PriorityCount] = {0, 0, 0};
+    uint64_t _batches = 0;
+    std::chrono::steady_clock::time_point _statsStart;
+
+    std::unique_ptr<I2CTracer> _ownedTracer;
+    std::atomic<I2CTracer*> _tracer{nullptr};
+    std::chrono::steady_clock::time_point _traceEpoch;
+};
+
+// point the C interface (and so ABE_IoPi) at another adapter for the
+// lifetime of this object, on the current thread
+class I2CBusSelection
+{
+public:
+    explicit I2CBusSelection(int number) :
+        _previous(i2c_bus_selected())
+    {
+        i2c_bus_select(number);
+    }
+
+    ~I2CBusSelection()
+    {
+        i2c_bus_select(_previous);
+    }
+private:
+    const int _previous;
+};
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef I2C_BUS_API_H
+#define I2C_BUS_API_H
+
+/*
+ C interface to the I2CBus manager, for the ABE IO Pi code. One message is
+ one segment of a combined transaction, as with the kernel's i2c_msg.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define I2C_MSG_READ 0x1
+
+// request priorities, most urgent first
+#define I2C_PRIORITY_INPUT 0
+#define I2C_PRIORITY_LAMP 1
+#define I2C_PRIORITY_GAUGE 2
+
+typedef struct {
+	unsigned short address;
+	unsigned short flags;
+	unsigned short length;
+	unsigned char *data;
+} I2CMessage;
+
+/**
+* choose the adapter the calls below use from this thread, default 1
+* @param number - /dev/i2c-<number>
+*/
+void i2c_bus_select(int number);
+
+int i2c_bus_selected(void);
+
+/**
+* run a combined transaction on the selected adapter, blocking until done
+* @param priority - one of the I2C_PRIORITY values
+* @param msgs - messages to transfer, in order
+* @param count - number of messages
+* @returns - 0 on success, -1 on failure
+*/
+int i2c_bus_transfer(int priority, I2CMessage *msgs, int count);
+
+/**
+* read consecutive registers from a device
+* @returns - 0 on success, -1 on failure
+*/
+int i2c_bus_read(int priority, unsigned char address, unsigned char reg, unsigned char *data, int length);
+
+/**
+* write consecutive registers on a device
+* @returns - 0 on success, -1 on failure
+*/
+int i2c_bus_write(int priority, unsigned char address, unsigned char reg, const unsigned char *data, int length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
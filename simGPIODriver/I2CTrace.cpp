@@ -0,0 +1,196 @@
+#include "I2CTrace.h"
+
+#include <fstream>
+#include <map>
+#include <iomanip>
+#include <cstring>
+#include <algorithm>
+
+static const char TraceMagic[4] = {'I', '2', 'C', 'T'};
+static const uint32_t TraceVersion = 1;
+
+static size_t roundUpPow2(size_t n)
+{
+    size_t p = 1;
+    while (p < n) {
+        p <<= 1;
+    }
+    return p;
+}
+
+I2CTracer::I2CTracer(size_t capacity) :
+    _mask(roundUpPow2(capacity) - 1),
+    _slots(new Slot[_mask + 1])
+{
+}
+
+static uint64_t pack(const I2CTraceRecord& r)
+{
+    return static_cast<uint64_t>(r.durationNsec) |
+        (static_cast<uint64_t>(r.address) << 32) |
+        (static_cast<uint64_t>(r.reg) << 40) |
+        (static_cast<uint64_t>(r.length) << 48) |
+        (static_cast<uint64_t>(r.flags) << 56);
+}
+
+static I2CTraceRecord unpack(uint64_t start, uint64_t packed)
+{
+    I2CTraceRecord r;
+    r.startNsec = start;
+    r.durationNsec = packed & 0xffffffff;
+    r.address = (packed >> 32) & 0xff;
+    r.reg = (packed >> 40) & 0xff;
+    r.length = (packed >> 48) & 0xff;
+    r.flags = (packed >> 56) & 0xff;
+    return r;
+}
+
+void I2CTracer::record(const I2CTraceRecord& r)
+{
+    const uint64_t head = _head.load(std::memory_order_relaxed);
+    Slot& s = _slots[head & _mask];
+    s.start.store(r.startNsec, std::memory_order_relaxed);
+    s.packed.store(pack(r), std::memory_order_relaxed);
+    _head.store(head + 1, std::memory_order_release);
+}
+
+std::vector<I2CTraceRecord> I2CTracer::snapshot() const
+{
+    const uint64_t capacity = _mask + 1;
+    const uint64_t head = _head.load(std::memory_order_acquire);
+    const uint64_t first = (head > capacity) ? head - capacity : 0;
+
+    std::vector<I2CTraceRecord> result;
+    result.reserve(head - first);
+    for (uint64_t i = first; i < head; ++i) {
+        const Slot& s = _slots[i & _mask];
+        result.push_back(unpack(s.start.load(std::memory_order_relaxed),
+                                s.packed.load(std::memory_order_relaxed)));
+    }
+
+    // anything the producer lapped while we were copying, including the
+    // slot it may be writing right now, is garbage
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const uint64_t after = _head.load(std::memory_order_relaxed);
+    const uint64_t unsafeBelow = (after + 1 > capacity) ? after + 1 - capacity : 0;
+    if (unsafeBelow > first) {
+        const size_t drop = std::min<uint64_t>(unsafeBelow - first, result.size());
+        result.erase(result.begin(), result.begin() + drop);
+    }
+
+    return result;
+}
+
+static void putLE(std::ostream& os, uint64_t v, int bytes)
+{
+    for (int i=0; i < bytes; ++i) {
+        os.put(static_cast<char>((v >> (i * 8)) & 0xff));
+    }
+}
+
+static uint64_t getLE(const unsigned char* p, int bytes)
+{
+    uint64_t v = 0;
+    for (int i=0; i < bytes; ++i) {
+        v |= static_cast<uint64_t>(p[i]) << (i * 8);
+    }
+    return v;
+}
+
+bool I2CTracer::write(const std::string& path, const std::vector<I2CTraceRecord>& records)
+{
+    std::ofstream f(path, std::ios::binary);
+    f.write(TraceMagic, 4);
+    putLE(f, TraceVersion, 4);
+    putLE(f, records.size(), 4);
+    for (const auto& r : records) {
+        putLE(f, r.startNsec, 8);
+        putLE(f, pack(r), 8);
+    }
+
+    return f.good();
+}
+
+bool I2CTracer::read(const std::string& path, std::vector<I2CTraceRecord>& records)
+{
+    std::ifstream f(path, std::ios::binary);
+    unsigned char header[12];
+    if (!f.read(reinterpret_cast<char*>(header), sizeof(header)) ||
+        memcmp(header, TraceMagic, 4) || (getLE(header + 4, 4) != TraceVersion))
+    {
+        return false;
+    }
+
+    const uint32_t count = getLE(header + 8, 4);
+    records.clear();
+    records.reserve(count);
+    unsigned char buf[16];
+    for (uint32_t i=0; i < count; ++i) {
+        if (!f.read(reinterpret_cast<char*>(buf), sizeof(buf))) {
+            return false;
+        }
+        records.push_back(unpack(getLE(buf, 8), getLE(buf + 8, 8)));
+    }
+
+    return true;
+}
+
+void I2CTracer::summarize(const std::vector<I2CTraceRecord>& records, std::ostream& os)
+{
+    if (records.empty()) {
+        os << "I2C trace: no transactions" << std::endl;
+        return;
+    }
+
+    struct Device
+    {
+        uint64_t transactions = 0;
+        uint64_t bytes = 0;
+        uint64_t busyNsec = 0;
+        uint64_t errors = 0;
+    };
+
+    std::map<uint8_t, Device> devices;
+    uint64_t busyNsec = 0;
+    const I2CTraceRecord* longest = &records.front();
+    const uint64_t begin = records.front().startNsec;
+    uint64_t end = begin;
+
+    for (const auto& r : records) {
+        Device& d = devices[r.address];
+        d.transactions++;
+        d.bytes += r.length;
+        d.busyNsec += r.durationNsec;
+        d.errors += (r.flags & I2CTraceRecord::Error) ? 1 : 0;
+
+        busyNsec += r.durationNsec;
+        end = std::max(end, r.startNsec + r.durationNsec);
+        if (r.durationNsec > longest->durationNsec) {
+            longest = &r;
+        }
+    }
+
+    const double window = std::max<uint64_t>(end - begin, 1) / 1e9;
+    os << std::fixed << std::setprecision(1)
+       << "I2C trace: " << records.size() << " transactions over " << (window * 1000) << " msec"
+       << ", occupancy " << (100.0 * busyNsec / 1e9 / window) << "%"
+       << ", longest stall " << (longest->durationNsec / 1000.0) << " usec"
+       << " (0x" << std::hex << static_cast<int>(longest->address)
+       << " reg 0x" << static_cast<int>(longest->reg) << std::dec
+       << ", " << static_cast<int>(longest->length) << " bytes)"
+       << std::endl;
+
+    for (const auto& it : devices) {
+        const Device& d = it.second;
+        os << "  0x" << std::hex << static_cast<int>(it.first) << std::dec
+           << ": " << (d.transactions / window) << " trans/sec"
+           << ", " << (d.bytes / window) << " bytes/sec"
+           << ", " << (100.0 * d.busyNsec / 1e9 / window) << "% of bus"
+           << ", avg " << (d.busyNsec / 1000.0 / d.transactions) << " usec"
+           << ", errors " << d.errors
+           << std::endl;
+    }
+
+    os.unsetf(std::ios::floatfield);
+    os << std::setprecision(6);
+}
@@ -0,0 +1,64 @@
+#ifndef I2C_TRACE_H
+#define I2C_TRACE_H
+
+#include <cstdint>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <ostream>
+#include <memory>
+
+struct I2CTraceRecord
+{
+    enum Flags
+    {
+        Read = 0x1, // the transaction read data back
+        Error = 0x2,
+        Batched = 0x4, // shared one adapter transfer with other requests
+        Retry = 0x8
+    };
+
+    uint64_t startNsec; // since the tracer was created
+    uint32_t durationNsec;
+    uint8_t address;
+    uint8_t reg; // first register touched, 0xff for a bare read
+    uint8_t length; // data bytes, not counting the register pointer
+    uint8_t flags;
+};
+
+// Records every bus transaction into a fixed ring, overwriting the oldest
+// once full. record() is wait-free and must only be called from one thread
+// (the bus worker); snapshot() may run concurrently on any other thread.
+class I2CTracer
+{
+public:
+    // capacity is rounded up to a power of two
+    explicit I2CTracer(size_t capacity = 65536);
+
+    void record(const I2CTraceRecord& r);
+
+    // the records currently held, oldest first
+    std::vector<I2CTraceRecord> snapshot() const;
+
+    // compact binary trace: "I2CT", u32 version, u32 count, then count
+    // packed 16-byte records, all little-endian as on the Pi
+    static bool write(const std::string& path, const std::vector<I2CTraceRecord>& records);
+    static bool read(const std::string& path, std::vector<I2CTraceRecord>& records);
+
+    // bus occupancy, transactions/sec per device and the longest stall
+    static void summarize(const std::vector<I2CTraceRecord>& records, std::ostream& os);
+private:
+    // each record is stored as two words so a concurrent snapshot never
+    // reads a slot that is only half updated
+    struct Slot
+    {
+        std::atomic<uint64_t> start{0};
+        std::atomic<uint64_t> packed{0};
+    };
+
+    const size_t _mask;
+    std::unique_ptr<Slot[]> _slots;
+    std::atomic<uint64_t> _head{0};
+};
+
+#endif
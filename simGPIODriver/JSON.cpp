@@ -0,0 +1,278 @@
+#include "JSON.h"
+
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+
+class JSONParser
+{
+public:
+    JSONParser(const std::string& text) :
+        _text(text)
+    {
+    }
+
+    bool parseDocument(JSONValue& result)
+    {
+        if (!parseValue(result, 0)) {
+            return false;
+        }
+
+        skipSpace();
+        if (_pos != _text.size()) {
+            return fail("unexpected text after the document");
+        }
+        return true;
+    }
+
+    std::string error;
+private:
+    static const int MaxDepth = 64;
+
+    bool fail(const std::string& what)
+    {
+        std::ostringstream os;
+        os << "line " << _line << ": " << what;
+        error = os.str();
+        return false;
+    }
+
+    void skipSpace()
+    {
+        while (_pos < _text.size()) {
+            const char c = _text[_pos];
+            if (c == '\n') {
+                ++_line;
+            } else if ((c != ' ') && (c != '\t') && (c != '\r')) {
+                return;
+            }
+            ++_pos;
+        }
+    }
+
+    bool consume(const char* word)
+    {
+        const size_t len = strlen(word);
+        if (_text.compare(_pos, len, word) != 0) {
+            return false;
+        }
+        _pos += len;
+        return true;
+    }
+
+    bool parseValue(JSONValue& v, int depth)
+    {
+        if (depth > MaxDepth) {
+            return fail("nested too deeply");
+        }
+
+        skipSpace();
+        v._line = _line;
+        if (_pos >= _text.size()) {
+            return fail("unexpected end of file");
+        }
+
+        const char c = _text[_pos];
+        if (c == '{') {
+            return parseObject(v, depth);
+        } else if (c == '[') {
+            return parseArray(v, depth);
+        } else if (c == '"') {
+            v._type = JSONValue::Type::String;
+            return parseString(v._string);
+        } else if (consume("true")) {
+            v._type = JSONValue::Type::Bool;
+            v._bool = true;
+            return true;
+        } else if (consume("false")) {
+            v._type = JSONValue::Type::Bool;
+            return true;
+        } else if (consume("null")) {
+            return true;
+        }
+
+        const char* start = _text.c_str() + _pos;
+        char* end = nullptr;
+        v._number = strtod(start, &end);
+        if (end == start) {
+            return fail(std::string("unexpected '") + c + "'");
+        }
+        v._type = JSONValue::Type::Number;
+        _pos += end - start;
+        return true;
+    }
+
+    bool parseObject(JSONValue& v, int depth)
+    {
+        v._type = JSONValue::Type::Object;
+        ++_pos; // {
+        skipSpace();
+        if ((_pos < _text.size()) && (_text[_pos] == '}')) {
+            ++_pos;
+            return true;
+        }
+
+        for (;;) {
+            skipSpace();
+            if ((_pos >= _text.size()) || (_text[_pos] != '"')) {
+                return fail("expected a member name");
+            }
+
+            JSONValue::Member m;
+            if (!parseString(m.first)) {
+                return false;
+            }
+
+            skipSpace();
+            if ((_pos >= _text.size()) || (_text[_pos] != ':')) {
+                return fail("expected ':' after \"" + m.first + "\"");
+            }
+            ++_pos;
+
+            if (!parseValue(m.second, depth + 1)) {
+                return false;
+            }
+            v._members.push_back(std::move(m));
+
+            skipSpace();
+            if (_pos >= _text.size()) {
+                return fail("unterminated object");
+            }
+            if (_text[_pos] == '}') {
+                ++_pos;
+                return true;
+            }
+            if (_text[_pos] != ',') {
+                return fail("expected ',' or '}'");
+            }
+            ++_pos;
+        }
+    }
+
+    bool parseArray(JSONValue& v, int depth)
+    {
+        v._type = JSONValue::Type::Array;
+        ++_pos; // [
+        skipSpace();
+        if ((_pos < _text.size()) && (_text[_pos] == ']')) {
+            ++_pos;
+            return true;
+        }
+
+        for (;;) {
+            v._array.emplace_back();
+            if (!parseValue(v._array.back(), depth + 1)) {
+                return false;
+            }
+
+            skipSpace();
+            if (_pos >= _text.size()) {
+                return fail("unterminated array");
+            }
+            if (_text[_pos] == ']') {
+                ++_pos;
+                return true;
+            }
+            if (_text[_pos] != ',') {
+                return fail("expected ',' or ']'");
+            }
+            ++_pos;
+        }
+    }
+
+    // the configuration files are ASCII; \u escapes outside it are refused
+    bool parseString(std::string& s)
+    {
+        ++_pos; // opening quote
+        while (_pos < _text.size()) {
+            const char c = _text[_pos++];
+            if (c == '"') {
+                return true;
+            }
+            if (c == '\n') {
+                return fail("unterminated string");
+            }
+            if (c != '\\') {
+                s += c;
+                continue;
+            }
+
+            if (_pos >= _text.size()) {
+                break;
+            }
+
+            const char e = _text[_pos++];
+            switch (e) {
+            case '"': s += '"'; break;
+            case '\\': s += '\\'; break;
+            case '/': s += '/'; break;
+            case 'b': s += '\b'; break;
+            case 'f': s += '\f'; break;
+            case 'n': s += '\n'; break;
+            case 'r': s += '\r'; break;
+            case 't': s += '\t'; break;
+            case 'u': {
+                const std::string hex = _text.substr(_pos, 4);
+                char* end = nullptr;
+                const long code = strtol(hex.c_str(), &end, 16);
+                if ((hex.size() != 4) || (*end != 0) || (code > 0x7f)) {
+                    return fail("unsupported \\u escape");
+                }
+                s += static_cast<char>(code);
+                _pos += 4;
+                break;
+            }
+            default:
+                return fail(std::string("bad escape '\\") + e + "'");
+            }
+        }
+
+        return fail("unterminated string");
+    }
+
+    const std::string& _text;
+    size_t _pos = 0;
+    int _line = 1;
+};
+
+bool JSONValue::parse(const std::string& text, JSONValue& result, std::string& error)
+{
+    result = JSONValue();
+    JSONParser p(text);
+    if (!p.parseDocument(result)) {
+        error = p.error;
+        return false;
+    }
+
+    return true;
+}
+
+bool JSONValue::parseFile(const std::string& path, JSONValue& result, std::string& error)
+{
+    std::ifstream f(path);
+    if (!f) {
+        error = "can't open " + path;
+        return false;
+    }
+
+    std::ostringstream text;
+    text << f.rdbuf();
+    if (!parse(text.str(), result, error)) {
+        error = path + ": " + error;
+        return false;
+    }
+
+    return true;
+}
+
+const JSONValue* JSONValue::find(const std::string& key) const
+{
+    for (const auto& m : _members) {
+        if (m.first == key) {
+            return &m.second;
+        }
+    }
+
+    return nullptr;
+}
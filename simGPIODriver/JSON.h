@@ -0,0 +1,99 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <string>
+#include <vector>
+#include <utility>
+
+// Just enough JSON for the panel configuration files: a parsed tree of
+// values, with the source line of each kept for error messages. Object
+// members stay in file order.
+class JSONValue
+{
+public:
+    enum class Type
+    {
+        Null,
+        Bool,
+        Number,
+        String,
+        Array,
+        Object
+    };
+
+    using Member = std::pair<std::string, JSONValue>;
+
+    // on failure <error> says what and where
+    static bool parse(const std::string& text, JSONValue& result, std::string& error);
+    static bool parseFile(const std::string& path, JSONValue& result, std::string& error);
+
+    Type type() const
+    {
+        return _type;
+    }
+
+    bool isNumber() const
+    {
+        return _type == Type::Number;
+    }
+
+    bool isString() const
+    {
+        return _type == Type::String;
+    }
+
+    bool isArray() const
+    {
+        return _type == Type::Array;
+    }
+
+    bool isObject() const
+    {
+        return _type == Type::Object;
+    }
+
+    bool boolean() const
+    {
+        return _bool;
+    }
+
+    double number() const
+    {
+        return _number;
+    }
+
+    const std::string& string() const
+    {
+        return _string;
+    }
+
+    const std::vector<JSONValue>& array() const
+    {
+        return _array;
+    }
+
+    const std::vector<Member>& members() const
+    {
+        return _members;
+    }
+
+    // object member by name, or nullptr
+    const JSONValue* find(const std::string& key) const;
+
+    int line() const
+    {
+        return _line;
+    }
+private:
+    friend class JSONParser;
+
+    Type _type = Type::Null;
+    int _line = 0;
+    bool _bool = false;
+    double _number = 0.0;
+    std::string _string;
+    std::vector<JSONValue> _array;
+    std::vector<Member> _members;
+};
+
+#endif
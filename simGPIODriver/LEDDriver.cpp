@@ -1,21 +1,15 @@
 
 #include "LEDDriver.h"
 
-#include <linux/i2c-dev.h>
-
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <algorithm>
 #include <cmath>
-#include <errno.h>
-#include <fcntl.h>
-#include <unistd.h> // for usleep
-#include <sys/ioctl.h>
 
 #include <iostream>
 
-static const char *fileName = "/dev/i2c-1"; // change to /dev/i2c-0 if you are using a revision 0002 or 0003 model B
+#include "I2CBus.h"
 
 
 #define PCA9622_SUBADR1 0x18
@@ -28,12 +22,19 @@ static const char *fileName = "/dev/i2c-1"; // change to /dev/i2c-0 if you are u
 #define PCA9622_MODE2 0x1
 
 #define PCA9622_PWM0 0x02
+#define PCA9622_GRPPWM 0x12
+#define PCA9622_GRPFREQ 0x13
 
 #define PCA9622_LEDOUT0 0x14
 #define PCA9622_LEDOUT1 0x15
 #define PCA9622_LEDOUT2 0x16
 #define PCA9622_LEDOUT3 0x17
 
+#define PCA9622_DMBLNK 0x20
+
+// control byte flags selecting auto-increment for one transaction
+#define PCA9622_AI_ALL 0x80
+
 #define LED0_ON_L 0x6
 #define LED0_ON_H 0x7
 #define LED0_OFF_L 0x8
@@ -47,19 +48,11 @@ static const char *fileName = "/dev/i2c-1"; // change to /dev/i2c-0 if you are u
 // Set to true to print some debug messages, or false to disable them.
 //#define ENABLE_DEBUG_OUTPUT
 
-LEDDriver::LEDDriver(uint8_t addr)
+LEDDriver::LEDDriver(uint8_t addr, int bus)
 {
   _i2caddr = addr;
-
-  if ((_i2cHandle = open(fileName, O_RDWR)) < 0) {
-		printf("Failed to open i2c port for read %s \n", strerror(errno));
-		exit(1);
-	}
-
-	if (ioctl(_i2cHandle, I2C_SLAVE, _i2caddr) < 0) {
-		printf("Failed to write to i2c port for read\n");
-		exit(1);
-	}
+  _bus = &I2CBus::get(bus);
+  std::fill(std::begin(_levels), std::end(_levels), 0xff);
 }
 
 
@@ -73,16 +66,31 @@ void LEDDriver::begin(void)
   reset();
 
   const uint8_t ALLCALL = 0x00; // all-call and subaddr disabled
-  const uint8_t AUTO_INCREMENT = 0x00; // disable auto-increment
   const uint8_t SLEEP = 0x00; // disable sleep
 
-  write8(PCA9622_MODE1, ALLCALL | AUTO_INCREMENT | SLEEP);
+  // the MODE1 auto-increment bits are read-only: commit() selects
+  // auto-increment per transaction through the control byte instead
+  write8(PCA9622_MODE1, ALLCALL | SLEEP);
 
   const uint8_t DMBLNK = 0x00; // group-control = dimming
   const uint8_t INVRT = 0x00; // reserved
   const uint8_t MODE2_RESERVED = 0x05; // reserved, must be set
 
-  write8(PCA9622_MODE2, DMBLNK | INVRT | MODE2_RESERVED);
+  // start from a known state rather than whatever the chip holds
+  _mode2 = DMBLNK | INVRT | MODE2_RESERVED;
+  std::fill(std::begin(_pwm), std::end(_pwm), 0);
+  std::fill(std::begin(_ledout), std::end(_ledout), 0);
+  _grppwm = 0xff;
+  _grpfreq = 0;
+  std::fill(std::begin(_lamps), std::end(_lamps), LampMode::Off);
+  std::fill(std::begin(_levels), std::end(_levels), 0xff);
+  _dimmed = 0;
+  _brightness = 0xff;
+  _blinking = false;
+  for (uint8_t reg = PCA9622_MODE2; reg <= PCA9622_LEDOUT3; ++reg) {
+    _dirty |= 1u << reg;
+  }
+  commit();
 }
 
 /**************************************************************************/
@@ -97,10 +105,11 @@ void LEDDriver::reset(void)
 
 /**************************************************************************/
 /*!
-    @brief  Sets the PWM output of one of the PCA9685 pins
-    @param  num One of the PWM output pins, from 0 to 15
-    @param  on At what point in the 4096-part cycle to turn the PWM output ON
-    @param  off At what point in the 4096-part cycle to turn the PWM output OFF
+    @brief  Sets the individual brightness of one of the PCA9622 outputs.
+            Only the shadow register changes until flush() or
+            commit()
+    @param  num One of the LED outputs, from 0 to 15
+    @param  brightness Duty cycle, 0-255, used in the PWM states
 */
 /**************************************************************************/
 void LEDDriver::setPWM(uint8_t num, uint8_t brightness)
@@ -108,61 +117,329 @@ void LEDDriver::setPWM(uint8_t num, uint8_t brightness)
 #ifdef ENABLE_DEBUG_OUTPUT
   Serial.print("Setting PWM "); Serial.print(num); Serial.print(": "); Serial.print(brightness);
 #endif
-  write8(PCA9622_PWM0 + num, brightness);
+  if (_pwm[num] == brightness) {
+    return;
+  }
+
+  _pwm[num] = brightness;
+  _dirty |= 1u << (PCA9622_PWM0 + num);
 }
 
+/**************************************************************************/
+/*!
+    @brief  Sets the LEDOUT state of one of the PCA9622 outputs. Only the
+            shadow register changes until flush() or commit()
+    @param  num One of the LED outputs, from 0 to 15
+    @param  state One of PCA9622_STATE_*
+*/
+/**************************************************************************/
 void LEDDriver::setState(uint8_t num, uint8_t state)
 {
 #ifdef ENABLE_DEBUG_OUTPUT
   Serial.print("Setting state "); Serial.print(num); Serial.print(": "); Serial.print(state);
 #endif
-    uint8_t controlRegister = PCA9622_LEDOUT0 + (num >> 2);
-    uint8_t controlOffset = (num & 0x3) * 2;
-    uint8_t controlMask = ~(0x3 << controlOffset);
+  const uint8_t index = num >> 2;
+  const uint8_t offset = (num & 0x3) * 2;
+  const uint8_t value = (_ledout[index] & ~(0x3 << offset)) | ((state & 0x3) << offset);
+  if (_ledout[index] == value) {
+    return;
+  }
 
-    uint8_t value = read8(controlRegister) & controlMask;
-    write8(controlRegister, value | (state << controlOffset));
+  _ledout[index] = value;
+  _dirty |= 1u << (PCA9622_LEDOUT0 + index);
 }
 
-/*******************************************************************************************/
+/**************************************************************************/
+/*!
+    @brief  Sets the group duty cycle applied to every output in the
+            PCA9622_STATE_PWM_GROUP state: dimming the whole panel is a
+            single register write. Only the shadow register changes until
+            flush() or commit()
+    @param  brightness Duty cycle, 0-255
+*/
+/**************************************************************************/
+void LEDDriver::setGroupPWM(uint8_t brightness)
+{
+  if (_grppwm == brightness) {
+    return;
+  }
+
+  _grppwm = brightness;
+  _dirty |= 1u << PCA9622_GRPPWM;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Switches a lamp off, steady on or blinking. Blinking lamps use
+            the group state, so they only flash while setBlinking() is on;
+            otherwise they are lit steadily.
+    @param  num One of the LED outputs, from 0 to 15
+    @param  mode The lamp mode
+*/
+/**************************************************************************/
+void LEDDriver::setLamp(uint8_t num, LampMode mode)
+{
+  _lamps[num] = mode;
+  applyLamp(num);
+}
+
+void LEDDriver::setDimmed(uint8_t num, bool dimmed)
+{
+  if (dimmed) {
+    _dimmed |= 1u << num;
+  } else {
+    _dimmed &= ~(1u << num);
+  }
+  applyLamp(num);
+}
+
+/**************************************************************************/
+/*!
+    @brief  Sets how brightly a lamp is lit, for effects such as fading.
+            Dimmed lamps are scaled by the panel brightness as well.
+    @param  num One of the LED outputs, from 0 to 15
+    @param  level Intensity, 0-255
+*/
+/**************************************************************************/
+void LEDDriver::setLevel(uint8_t num, uint8_t level)
+{
+  if (_levels[num] == level) {
+    return;
+  }
+
+  _levels[num] = level;
+  applyLamp(num);
+}
+
+/**************************************************************************/
+/*!
+    @brief  Sets the brightness of dimmed lamps. While the group control
+            dims this is the one GRPPWM register; while it blinks, GRPPWM
+            is the blink duty cycle, so each dimmed lamp's own PWM register
+            is written instead.
+    @param  brightness Duty cycle, 0-255
+*/
+/**************************************************************************/
+void LEDDriver::setBrightness(uint8_t brightness)
+{
+  _brightness = brightness;
+  if (!_blinking) {
+    setGroupPWM(brightness);
+    return;
+  }
+
+  for (uint8_t i = 0; i < 16; ++i) {
+    if (_dimmed & (1u << i)) {
+      applyLamp(i);
+    }
+  }
+}
+
+/**************************************************************************/
+/*!
+    @brief  Switches the group control between dimming and blinking. While
+            blinking, the chip flashes every lamp in LampMode::Blink with
+            no further I2C traffic.
+    @param  enable Blink instead of dim
+    @param  periodSec Blink period, 1/24 s to 10.7 s
+    @param  dutyCycle Fraction of the period the lamps are lit
+*/
+/**************************************************************************/
+void LEDDriver::setBlinking(bool enable, double periodSec, double dutyCycle)
+{
+  _blinking = enable;
+
+  const uint8_t mode2 = enable ? (_mode2 | PCA9622_DMBLNK) : (_mode2 & ~PCA9622_DMBLNK);
+  if (mode2 != _mode2) {
+    _mode2 = mode2;
+    _dirty |= 1u << PCA9622_MODE2;
+  }
+
+  if (enable) {
+    // period = (GRPFREQ + 1) / 24 s, duty = GRPPWM / 256
+    const long freq = std::lround(periodSec * 24.0) - 1;
+    const long duty = std::lround(dutyCycle * 256.0);
+    const uint8_t grpfreq = static_cast<uint8_t>(std::min(std::max(freq, 0L), 255L));
+    if (grpfreq != _grpfreq) {
+      _grpfreq = grpfreq;
+      _dirty |= 1u << PCA9622_GRPFREQ;
+    }
+    setGroupPWM(static_cast<uint8_t>(std::min(std::max(duty, 0L), 255L)));
+  } else {
+    setGroupPWM(_brightness);
+  }
+
+  for (uint8_t i = 0; i < 16; ++i) {
+    applyLamp(i);
+  }
+}
+
+void LEDDriver::applyLamp(uint8_t num)
+{
+  const bool dimmed = _dimmed & (1u << num);
+  const uint8_t level = _levels[num];
+  // while blinking, GRPPWM is the duty cycle: dim in the channel PWM
+  const uint8_t scaled = (dimmed && _blinking) ? (level * _brightness + 127) / 255 : level;
+
+  switch (_lamps[num]) {
+  case LampMode::Off:
+    setState(num, PCA9622_STATE_OFF);
+    break;
+
+  case LampMode::Blink:
+    if (_blinking) {
+      setPWM(num, scaled);
+      setState(num, PCA9622_STATE_PWM_GROUP);
+      break;
+    }
+    // steady until blinking is enabled
+    // fall through
+
+  case LampMode::On:
+    if (!dimmed && (level == 0xff)) {
+      setState(num, PCA9622_STATE_ON);
+    } else if (!dimmed || _blinking) {
+      setPWM(num, scaled);
+      setState(num, PCA9622_STATE_PWM);
+    } else {
+      setPWM(num, level);
+      setState(num, PCA9622_STATE_PWM_GROUP);
+    }
+    break;
+  }
+}
+
+uint8_t LEDDriver::state(uint8_t num) const
+{
+  return (_ledout[num >> 2] >> ((num & 0x3) * 2)) & 0x3;
+}
+
+uint8_t LEDDriver::pwm(uint8_t num) const
+{
+  return _pwm[num];
+}
+
+uint8_t LEDDriver::groupPWM() const
+{
+  return _grppwm;
+}
+
+uint8_t LEDDriver::brightness() const
+{
+  return _brightness;
+}
+
+uint8_t LEDDriver::shadow(uint8_t reg) const
+{
+  if (reg >= PCA9622_LEDOUT0) {
+    return _ledout[reg - PCA9622_LEDOUT0];
+  } else if (reg == PCA9622_MODE2) {
+    return _mode2;
+  } else if (reg == PCA9622_GRPFREQ) {
+    return _grpfreq;
+  } else if (reg == PCA9622_GRPPWM) {
+    return _grppwm;
+  }
+
+  return _pwm[reg - PCA9622_PWM0];
+}
+
+bool LEDDriver::dirty(void) const
+{
+  return _dirty != 0;
+}
 
-uint8_t LEDDriver::read8(uint8_t addr)
+/**************************************************************************/
+/*!
+    @brief  Writes the shadow registers changed since the last flush, one
+            transaction per register
+    @return false if a write failed; those registers stay dirty
+*/
+/**************************************************************************/
+bool LEDDriver::flush(void)
+{
+  bool ok = true;
+  for (uint8_t reg = PCA9622_MODE2; reg <= PCA9622_LEDOUT3; ++reg) {
+    const uint32_t bit = 1u << reg;
+    if (!(_dirty & bit)) {
+      continue;
+    }
+
+    if (write8(reg, shadow(reg))) {
+      _dirty &= ~bit;
+    } else {
+      ok = false;
+    }
+  }
+
+  return ok;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Writes the shadow registers changed since the last commit as
+            one auto-increment burst, from the lowest dirty register to
+            the highest. Clean registers in between are rewritten with
+            their shadow values.
+    @return false if the write failed; everything stays dirty
+*/
+/**************************************************************************/
+bool LEDDriver::commit(void)
 {
-  uint8_t buf[1] = { addr };
-  if ((write(_i2cHandle, buf, 1)) != 1) {
-		printf("Failed to write to i2c device for read\n");
-		exit(1);
-	}
+  if (!_dirty) {
+    return true;
+  }
+
+  uint8_t first = PCA9622_MODE2;
+  while (!(_dirty & (1u << first))) {
+    ++first;
+  }
+  uint8_t last = PCA9622_LEDOUT3;
+  while (!(_dirty & (1u << last))) {
+    --last;
+  }
 
-  if (read(_i2cHandle, buf, 1) != 1) { // Read back data into buf[]
-		printf("Failed to read from slave\n");
-		exit(1);
-	}
+  uint8_t frame[PCA9622_LEDOUT3 - PCA9622_MODE2 + 1];
+  for (uint8_t reg = first; reg <= last; ++reg) {
+    frame[reg - first] = shadow(reg);
+  }
 
-  return buf[0];
+  if (!_bus->writeRegisters(I2CPriority::Lamp, _i2caddr, PCA9622_AI_ALL | first, frame, last - first + 1)) {
+    return false;
+  }
+
+  _dirty = 0;
+  return true;
 }
 
-void LEDDriver::write8(uint8_t addr, uint8_t d) {
-  uint8_t buf[2] = { addr, d };
-  if ((write(_i2cHandle, buf, 2)) != 2) {
-		printf("Failed to write to i2c device for write\n");
-		exit(1);
-	}
+/*******************************************************************************************/
+
+bool LEDDriver::write8(uint8_t addr, uint8_t d) {
+  return _bus->writeRegisters(I2CPriority::Lamp, _i2caddr, addr, &d, 1);
 }
 
-LEDOutput::LEDOutput(LEDDriver* driver, uint8_t num) :
+LEDOutput::LEDOutput(LEDDriver* driver, uint8_t num, bool dimmed) :
   _index(num),
   _driver(driver)
 {
-  setState(false); // sync initial state
+  // sync initial state
+  _driver->setDimmed(_index, dimmed);
+  _driver->setLamp(_index, LampMode::Off);
+  _driver->commit();
 }
 
 void LEDOutput::setState(bool b)
 {
-  if (b == _state) {
+  setMode(b ? LampMode::On : LampMode::Off);
+}
+
+void LEDOutput::setMode(LampMode mode)
+{
+  if (mode == _mode) {
     return;
   }
 
-  _state = b;
-  _driver->setState(_index, b ? PCA9622_STATE_ON : PCA9622_STATE_OFF);
-}
\ No newline at end of file
+  _mode = mode;
+  _driver->setLamp(_index, mode);
+  _driver->commit();
+}
@@ -3,11 +3,20 @@
 
 #include <cstdint>
 
+class I2CBus;
+
 #define PCA9622_STATE_OFF 0x0
 #define PCA9622_STATE_ON 0x1
 #define PCA9622_STATE_PWM 0x2
 #define PCA9622_STATE_PWM_GROUP 0x3
 
+enum class LampMode : uint8_t
+{
+  Off,
+  On,
+  Blink
+};
+
 /**************************************************************************/
 /*!
     @brief  Class that stores state and functions for interacting with PCA922 LED PWM chip
@@ -16,7 +25,7 @@
 
 class LEDDriver {
  public:
-  LEDDriver(uint8_t addr = 0x31);
+  LEDDriver(uint8_t addr = 0x31, int bus = 1);
 
   void begin(void);
   void reset(void);
@@ -24,24 +33,64 @@ class LEDDriver {
   void setState(uint8_t num, uint8_t state);
   void setPWM(uint8_t num, uint8_t brightness);
 
+  // brightness of every output in PCA9622_STATE_PWM_GROUP
+  void setGroupPWM(uint8_t brightness);
+
+  // lamp-level control on top of the registers: dimmed lamps follow
+  // setBrightness(), blinking lamps flash from the chip's group control
+  void setLamp(uint8_t num, LampMode mode);
+  void setDimmed(uint8_t num, bool dimmed);
+  // intensity of a lit lamp, on top of dimming; 0xff is fully on
+  void setLevel(uint8_t num, uint8_t level);
+  void setBrightness(uint8_t brightness);
+  void setBlinking(bool enable, double periodSec = 1.0, double dutyCycle = 0.5);
+
+  uint8_t state(uint8_t num) const;
+  uint8_t pwm(uint8_t num) const;
+  uint8_t groupPWM() const;
+  uint8_t brightness() const;
+
+  bool dirty(void) const;
+  bool flush(void);
+  bool commit(void);
+
  private:
   uint8_t _i2caddr;
-  int _i2cHandle = 0;
+  I2CBus* _bus = nullptr;
+
+  LampMode _lamps[16] = {};
+  uint8_t _levels[16];
+  uint16_t _dimmed = 0;
+  uint8_t _brightness = 0xff;
+  bool _blinking = false;
+
+  // shadow of MODE2, PWM0-15, GRPPWM, GRPFREQ and LEDOUT0-3, which only
+  // this driver writes
+  uint8_t _mode2 = 0;
+  uint8_t _pwm[16] = {};
+  uint8_t _grppwm = 0xff;
+  uint8_t _grpfreq = 0;
+  uint8_t _ledout[4] = {};
+  uint32_t _dirty = 0; // bit per register address
+
+  uint8_t shadow(uint8_t reg) const;
+  void applyLamp(uint8_t num);
 
-  uint8_t read8(uint8_t addr);
-  void write8(uint8_t addr, uint8_t d);
+  bool write8(uint8_t addr, uint8_t d);
 };
 
 class LEDOutput
 {
 public:
-  LEDOutput(LEDDriver* driver, uint8_t num);
+  // a dimmed output follows the driver's panel brightness while on
+  LEDOutput(LEDDriver* driver, uint8_t num, bool dimmed = false);
 
   void setState(bool b);
+  void setMode(LampMode mode);
 private:
   const uint8_t _index;
   LEDDriver* _driver;
-  bool _state = false;
+  LampMode _mode = LampMode::Off;
 };
 
 #endif
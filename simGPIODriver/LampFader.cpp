@@ -0,0 +1,134 @@
+#include "LampFader.h"
+
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+
+#include "LEDDriver.h"
+
+using namespace std::chrono;
+
+namespace {
+
+// Filament temperature follows an exponential towards its target and
+// light output rises roughly with its cube, so lamps come on quickly and
+// leave a short dim afterglow.
+const double FilamentRate = 4.0;
+
+std::vector<uint8_t> buildCurve(unsigned int steps, bool warming)
+{
+    const double floor = std::exp(-FilamentRate);
+    std::vector<uint8_t> curve(steps + 1);
+    for (unsigned int i = 0; i <= steps; ++i) {
+        const double x = static_cast<double>(i) / steps;
+        const double heat = (1.0 - std::exp(-FilamentRate * x)) / (1.0 - floor);
+        const double temperature = warming ? heat : (1.0 - heat);
+        curve[i] = static_cast<uint8_t>(std::lround(255.0 * std::pow(temperature, 3.0)));
+    }
+    return curve;
+}
+
+unsigned int stepsFor(milliseconds duration, unsigned int tickHz)
+{
+    return std::max(1L, std::lround(duration.count() * tickHz / 1000.0));
+}
+
+} // of anonymous namespace
+
+LampFader::LampFader(LEDDriver& driver, unsigned int tickHz, milliseconds warmUp, milliseconds coolDown) :
+    _driver(driver),
+    _interval(1000000 / tickHz),
+    _warmUp(buildCurve(stepsFor(warmUp, tickHz), true)),
+    _coolDown(buildCurve(stepsFor(coolDown, tickHz), false))
+{
+    for (int l = 0; l < 256; ++l) {
+        auto up = std::lower_bound(_warmUp.begin(), _warmUp.end(), l);
+        _warmUpFrom[l] = std::min<size_t>(up - _warmUp.begin(), _warmUp.size() - 1);
+
+        auto down = std::find_if(_coolDown.begin(), _coolDown.end(), [l](uint8_t v) { return v <= l; });
+        _coolDownFrom[l] = std::min<size_t>(down - _coolDown.begin(), _coolDown.size() - 1);
+    }
+
+    for (Channel& c : _channels) {
+        c.step = _coolDown.size() - 1; // dark
+    }
+}
+
+void LampFader::setFaded(uint8_t num, bool faded)
+{
+    const uint16_t bit = 1u << num;
+    if (faded) {
+        _faded |= bit;
+    } else {
+        _faded &= ~bit;
+        _moving &= ~bit;
+        _driver.setLevel(num, 0xff);
+        _driver.setLamp(num, _channels[num].on ? LampMode::On : LampMode::Off);
+    }
+}
+
+void LampFader::setLamp(uint8_t num, bool on)
+{
+    Channel& c = _channels[num];
+    if (c.on == on) {
+        return;
+    }
+
+    const uint16_t bit = 1u << num;
+    if (!(_faded & bit)) {
+        c.on = on;
+        c.step = on ? (_warmUp.size() - 1) : (_coolDown.size() - 1);
+        _driver.setLamp(num, on ? LampMode::On : LampMode::Off);
+        return;
+    }
+
+    // carry on from the current level along the other curve
+    const uint8_t current = level(c);
+    c.on = on;
+    c.step = on ? _warmUpFrom[current] : _coolDownFrom[current];
+    _moving |= bit;
+}
+
+bool LampFader::tick()
+{
+    const auto start = steady_clock::now();
+    const uint16_t lastWarmUp = _warmUp.size() - 1;
+    const uint16_t lastCoolDown = _coolDown.size() - 1;
+
+    for (uint16_t moving = _moving; moving; moving &= moving - 1) {
+        const uint8_t num = __builtin_ctz(moving);
+        Channel& c = _channels[num];
+        const uint16_t last = c.on ? lastWarmUp : lastCoolDown;
+        if (c.step < last) {
+            ++c.step;
+        }
+        if (c.step == last) {
+            _moving &= ~(1u << num);
+        }
+
+        const uint8_t l = level(c);
+        _driver.setLevel(num, l);
+        _driver.setLamp(num, (l > 0) ? LampMode::On : LampMode::Off);
+    }
+
+    const bool burst = _driver.dirty();
+    if (burst) {
+        _driver.commit();
+        ++_bursts;
+    }
+
+    const uint64_t nsec = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+    ++_ticks;
+    _tickNsec += nsec;
+    _maxTickNsec = std::max(_maxTickNsec, nsec);
+    return burst;
+}
+
+void LampFader::printStats(std::ostream& os)
+{
+    os << "Lamp fader: " << _ticks << " ticks, " << _bursts << " bursts"
+       << ", mean tick " << (_ticks ? (_tickNsec / _ticks / 1000) : 0) << " usec"
+       << ", max tick " << (_maxTickNsec / 1000) << " usec" << std::endl;
+
+    _ticks = _bursts = _tickNsec = _maxTickNsec = 0;
+}
@@ -0,0 +1,72 @@
+#ifndef LAMP_FADER_H
+#define LAMP_FADER_H
+
+#include <cstdint>
+#include <chrono>
+#include <vector>
+#include <iosfwd>
+
+class LEDDriver;
+
+// Incandescent warm-up and cool-down for lamps on a LEDDriver. Switching
+// a faded lamp only sets its target; tick(), called at a fixed rate,
+// steps each fading channel along a precomputed curve and commits the
+// changed registers as one auto-increment burst. A tick is at most
+// sixteen table lookups and one I2C transaction, however many lamps are
+// fading.
+class LampFader
+{
+public:
+    LampFader(LEDDriver& driver, unsigned int tickHz = 100,
+              std::chrono::milliseconds warmUp = std::chrono::milliseconds(80),
+              std::chrono::milliseconds coolDown = std::chrono::milliseconds(200));
+
+    // unfaded lamps switch at the next tick
+    void setFaded(uint8_t num, bool faded);
+    void setLamp(uint8_t num, bool on);
+
+    // true if a burst was written
+    bool tick();
+
+    bool fading() const
+    {
+        return _moving != 0;
+    }
+
+    std::chrono::microseconds tickInterval() const
+    {
+        return _interval;
+    }
+
+    void printStats(std::ostream& os);
+private:
+    struct Channel
+    {
+        bool on = false;
+        uint16_t step = 0; // into the curve for <on>
+    };
+
+    uint8_t level(const Channel& c) const
+    {
+        return c.on ? _warmUp[c.step] : _coolDown[c.step];
+    }
+
+    LEDDriver& _driver;
+    const std::chrono::microseconds _interval;
+
+    // level by step; the first step at or past a level, for reversing
+    // part-way through a fade
+    std::vector<uint8_t> _warmUp, _coolDown;
+    uint16_t _warmUpFrom[256], _coolDownFrom[256];
+
+    Channel _channels[16];
+    uint16_t _faded = 0;
+    uint16_t _moving = 0;
+
+    uint64_t _ticks = 0;
+    uint64_t _bursts = 0;
+    uint64_t _tickNsec = 0;
+    uint64_t _maxTickNsec = 0;
+};
+
+#endif
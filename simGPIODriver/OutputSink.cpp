@@ -0,0 +1,46 @@
+#include "OutputSink.h"
+
+#include <iostream>
+#include <algorithm>
+
+using namespace std::chrono;
+
+void OutputSet::add(OutputSink* sink)
+{
+    Backend b;
+    b.sink = sink;
+    _backends.push_back(b);
+}
+
+void OutputSet::commit()
+{
+    for (Backend& b : _backends) {
+        const auto start = steady_clock::now();
+        const unsigned int transactions = b.sink->commit();
+        const uint64_t nsec = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+
+        ++b.ticks;
+        if (transactions > 0) {
+            ++b.busyTicks;
+            b.transactions += transactions;
+        }
+        b.nsec += nsec;
+        b.maxNsec = std::max(b.maxNsec, nsec);
+    }
+}
+
+void OutputSet::printStats(std::ostream& os)
+{
+    const auto now = steady_clock::now();
+    const double elapsed = duration_cast<duration<double>>(now - _statsStart).count();
+    _statsStart = now;
+
+    for (Backend& b : _backends) {
+        os << "Outputs " << b.sink->name() << ": " << (b.transactions / elapsed) << " " << b.sink->commitUnit() << "/sec"
+           << " in " << b.busyTicks << " of " << b.ticks << " ticks"
+           << ", mean commit " << (b.ticks ? (b.nsec / b.ticks / 1000) : 0) << " usec"
+           << ", max commit " << (b.maxNsec / 1000) << " usec" << std::endl;
+
+        b.ticks = b.busyTicks = b.transactions = b.nsec = b.maxNsec = 0;
+    }
+}
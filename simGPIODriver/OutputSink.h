@@ -0,0 +1,76 @@
+#ifndef OUTPUT_SINK_H
+#define OUTPUT_SINK_H
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <iosfwd>
+#include <cstdint>
+
+// A device driving lamps: expander ports, the PCA9622, a HID panel.
+// Logic only sets lamp states; commit() sends whatever changed since the
+// previous output tick, batched as the device allows. Moving a lamp to
+// another board is then a change of sink and channel.
+class OutputSink
+{
+public:
+    virtual ~OutputSink() = default;
+
+    virtual std::string name() const = 0;
+
+    virtual void setLamp(unsigned int channel, bool on) = 0;
+
+    // returns the number of device transactions it took, or for a sink
+    // whose writes happen later on another thread, the number it queued
+    virtual unsigned int commit() = 0;
+
+    // what commit() counts
+    virtual const char* commitUnit() const
+    {
+        return "transactions";
+    }
+};
+
+// a lamp, wherever it is wired
+struct LampRef
+{
+    OutputSink* sink = nullptr;
+    unsigned int channel = 0;
+
+    void set(bool on) const
+    {
+        sink->setLamp(channel, on);
+    }
+
+    bool operator==(const LampRef& other) const
+    {
+        return (sink == other.sink) && (channel == other.channel);
+    }
+};
+
+// the output tick: commits every sink and keeps per-backend costs
+class OutputSet
+{
+public:
+    // not owned
+    void add(OutputSink* sink);
+
+    void commit();
+
+    void printStats(std::ostream& os);
+private:
+    struct Backend
+    {
+        OutputSink* sink;
+        uint64_t ticks = 0;
+        uint64_t busyTicks = 0; // ticks with anything to send
+        uint64_t transactions = 0;
+        uint64_t nsec = 0;
+        uint64_t maxNsec = 0;
+    };
+
+    std::vector<Backend> _backends;
+    std::chrono::steady_clock::time_point _statsStart = std::chrono::steady_clock::now();
+};
+
+#endif
@@ -0,0 +1,85 @@
+#include "PWMTicker.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "Adafruit_PWMServoDriver.h"
+
+using namespace std::chrono;
+
+PWMTicker::PWMTicker(Adafruit_PWMServoDriver& chip, unsigned int rateHz) :
+    _chip(chip),
+    _period(1000000 / rateHz)
+{
+}
+
+PWMTicker::~PWMTicker()
+{
+    stop();
+}
+
+bool PWMTicker::start(int realtimePriority)
+{
+    if (_running) {
+        return true;
+    }
+
+    _loop.addTimer(_period, [this](uint64_t expirations) {
+        if (expirations > 1) {
+            _overruns.fetch_add(expirations - 1, std::memory_order_relaxed);
+        }
+        tick(expirations);
+        _ticks.fetch_add(1, std::memory_order_relaxed);
+    });
+
+    _statsStart = steady_clock::now();
+    _running = true;
+    _thread = std::thread(&EventLoop::run, &_loop);
+
+    if (realtimePriority <= 0) {
+        return true;
+    }
+
+    sched_param param = {};
+    param.sched_priority = realtimePriority;
+    return pthread_setschedparam(_thread.native_handle(), SCHED_FIFO, &param) == 0;
+}
+
+void PWMTicker::stop()
+{
+    if (!_running) {
+        return;
+    }
+
+    _loop.quit();
+    _thread.join();
+    _running = false;
+}
+
+void PWMTicker::commitStaged()
+{
+    const unsigned int channels = _chip.dirtyChannels();
+    if (!channels) {
+        return;
+    }
+
+    if (_chip.commit()) {
+        _writes.fetch_add(channels, std::memory_order_relaxed);
+        _transactions.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        _failedCommits.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void PWMTicker::printRates(std::ostream& os)
+{
+    const auto now = steady_clock::now();
+    const double elapsed = duration_cast<duration<double>>(now - _statsStart).count();
+    _statsStart = now;
+
+    os << (_ticks.exchange(0) / elapsed) << " ticks/sec"
+       << ", " << (_writes.exchange(0) / elapsed) << " channel writes/sec"
+       << " in " << (_transactions.exchange(0) / elapsed) << " transactions/sec"
+       << ", failed " << _failedCommits.exchange(0)
+       << ", overruns " << _overruns.exchange(0);
+}
@@ -0,0 +1,60 @@
+#ifndef PWM_TICKER_H
+#define PWM_TICKER_H
+
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include <cstdint>
+
+#include "EventLoop.h"
+
+class Adafruit_PWMServoDriver;
+
+// A thread driving channels of one PCA9685 at a fixed rate, the common
+// part of the servo and stepper gauge drivers. Each tick() stages the
+// channels that changed and calls commitStaged(), which writes them as
+// one auto-increment burst and counts what reached the chip.
+class PWMTicker
+{
+public:
+    PWMTicker(Adafruit_PWMServoDriver& chip, unsigned int rateHz);
+
+    // subclasses must stop() in their own destructor, while tick() is
+    // still theirs
+    virtual ~PWMTicker();
+
+    // <realtimePriority> above zero asks for SCHED_FIFO; false if that
+    // was refused, the thread runs regardless
+    bool start(int realtimePriority = 0);
+    void stop();
+protected:
+    // on the ticking thread; <expirations> is above one when ticks were
+    // missed
+    virtual void tick(uint64_t expirations) = 0;
+
+    // a failed burst stays staged and goes again with the next call, even
+    // if nothing else changed by then
+    void commitStaged();
+
+    // ticks, channel writes and transactions per second since the last
+    // call, then the failed commits and overruns
+    void printRates(std::ostream& os);
+
+    Adafruit_PWMServoDriver& _chip;
+    const std::chrono::microseconds _period;
+private:
+    std::thread _thread;
+    bool _running = false;
+    EventLoop _loop; // owned by the ticking thread once started
+
+    // written by the ticking thread
+    std::atomic<uint64_t> _ticks{0};
+    std::atomic<uint64_t> _writes{0}; // channels
+    std::atomic<uint64_t> _transactions{0};
+    std::atomic<uint64_t> _failedCommits{0};
+    std::atomic<uint64_t> _overruns{0};
+    std::chrono::steady_clock::time_point _statsStart;
+};
+
+#endif
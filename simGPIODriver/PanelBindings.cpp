@@ -0,0 +1,190 @@
+#include "PanelBindings.h"
+
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+
+#include "JSON.h"
+
+BindingSet::BindingSet(const std::vector<uint8_t>& chips, const std::vector<PinRef>& reserved) :
+    _chips(chips)
+{
+    assert(_chips.size() <= MaxInputChips);
+    std::fill(std::begin(_onHigh), std::end(_onHigh), -1);
+    std::fill(std::begin(_onLow), std::end(_onLow), -1);
+
+    for (const PinRef& p : reserved) {
+        const auto it = std::find(_chips.begin(), _chips.end(), p.address);
+        if (it != _chips.end()) {
+            _reserved |= InputWord{1} << GPIOBank::bitIndex(it - _chips.begin(), p.port, p.bit);
+        }
+    }
+}
+
+bool BindingSet::add(PinRef pin, Trigger trigger, const std::string& label, const std::string& commandLine, std::string& error)
+{
+    std::ostringstream where;
+    where << "'" << label << "' (0x" << std::hex << int(pin.address) << std::dec
+          << " port " << int(pin.port) << " bit " << int(pin.bit) << "): ";
+
+    const auto chip = std::find(_chips.begin(), _chips.end(), pin.address);
+    if (chip == _chips.end()) {
+        error = where.str() + "no expander at that address";
+        return false;
+    }
+
+    if ((pin.port > 1) || (pin.bit > 7)) {
+        error = where.str() + "port must be 0-1 and bit 0-7";
+        return false;
+    }
+
+    const unsigned int b = GPIOBank::bitIndex(chip - _chips.begin(), pin.port, pin.bit);
+    const InputWord mask = InputWord{1} << b;
+    if (_reserved & mask) {
+        error = where.str() + "pin is a lamp output or encoder input";
+        return false;
+    }
+
+    const bool high = (trigger != Trigger::Low);
+    const bool low = (trigger != Trigger::High);
+    if ((high && (_rising & mask)) || (low && (_falling & mask))) {
+        error = where.str() + "pin already has a binding for that edge";
+        return false;
+    }
+
+    if (commandLine.size() + 2 > UINT16_MAX) {
+        error = where.str() + "command too long";
+        return false;
+    }
+
+    Entry e;
+    e.chip = chip - _chips.begin();
+    e.port = pin.port;
+    e.bit = pin.bit;
+    e.trigger = trigger;
+
+    e.label = _bytes.size();
+    _bytes.insert(_bytes.end(), label.begin(), label.end());
+    _bytes.push_back(0);
+
+    e.command = _bytes.size();
+    e.commandLength = 0;
+    if (!commandLine.empty()) {
+        _bytes.insert(_bytes.end(), commandLine.begin(), commandLine.end());
+        _bytes.push_back('\015');
+        _bytes.push_back('\012');
+        e.commandLength = commandLine.size() + 2;
+    }
+
+    const int16_t index = _entries.size();
+    _entries.push_back(e);
+    if (high) {
+        _onHigh[b] = index;
+        _rising |= mask;
+    }
+    if (low) {
+        _onLow[b] = index;
+        _falling |= mask;
+    }
+
+    return true;
+}
+
+bool readJSONInt(const JSONValue& object, const char* key, int& result, std::string& error)
+{
+    const JSONValue* v = object.find(key);
+    if (!v) {
+        error = "missing \"" + std::string(key) + "\"";
+        return false;
+    }
+
+    if (v->isNumber()) {
+        result = static_cast<int>(v->number());
+        return true;
+    }
+
+    // addresses are usually written in hex, which JSON numbers can't be
+    if (v->isString()) {
+        try {
+            size_t used = 0;
+            result = std::stoi(v->string(), &used, 0);
+            if (used == v->string().size()) {
+                return true;
+            }
+        } catch (std::exception&) {
+        }
+    }
+
+    error = "\"" + std::string(key) + "\" must be a number";
+    return false;
+}
+
+bool readJSONPin(const JSONValue& object, PinRef& pin, std::string& error)
+{
+    int address, port, bit;
+    if (!readJSONInt(object, "address", address, error) || !readJSONInt(object, "port", port, error) ||
+        !readJSONInt(object, "bit", bit, error))
+    {
+        return false;
+    }
+
+    if ((address < 0) || (address > 0x7f) || (port < 0) || (port > 1) || (bit < 0) || (bit > 7)) {
+        error = "address must be 0-0x7f, port 0-1 and bit 0-7";
+        return false;
+    }
+
+    pin = PinRef{static_cast<uint8_t>(address), static_cast<uint8_t>(port), static_cast<uint8_t>(bit)};
+    return true;
+}
+
+bool BindingSet::addJSON(const JSONValue& bindings, const std::string& source, std::string& error)
+{
+    if (!bindings.isArray()) {
+        error = source + ": \"bindings\" must be an array";
+        return false;
+    }
+
+    for (const JSONValue& b : bindings.array()) {
+        std::ostringstream prefix;
+        prefix << source << ":" << b.line() << ": ";
+        if (!b.isObject()) {
+            error = prefix.str() + "binding must be an object";
+            return false;
+        }
+
+        PinRef pin;
+        if (!readJSONPin(b, pin, error)) {
+            error = prefix.str() + error;
+            return false;
+        }
+
+        Trigger trigger = Trigger::High;
+        if (const JSONValue* t = b.find("trigger")) {
+            const std::string& name = t->string();
+            if (name == "high") {
+                trigger = Trigger::High;
+            } else if (name == "low") {
+                trigger = Trigger::Low;
+            } else if (name == "any") {
+                trigger = Trigger::AnyEdge;
+            } else {
+                error = prefix.str() + "trigger must be \"high\", \"low\" or \"any\"";
+                return false;
+            }
+        }
+
+        const JSONValue* label = b.find("label");
+        const JSONValue* command = b.find("command");
+        if ((label && !label->isString()) || (command && !command->isString())) {
+            error = prefix.str() + "\"label\" and \"command\" must be strings";
+            return false;
+        }
+
+        if (!add(pin, trigger, label ? label->string() : "", command ? command->string() : "", error)) {
+            error = prefix.str() + error;
+            return false;
+        }
+    }
+
+    return true;
+}
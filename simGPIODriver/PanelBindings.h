@@ -0,0 +1,109 @@
+#ifndef PANEL_BINDINGS_H
+#define PANEL_BINDINGS_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "GPIO.h"
+#include "BindingTable.h"
+
+class JSONValue;
+
+// Switch bindings compiled into flat arrays: per-bit entry indices for
+// each edge, and every label and command line preformatted (CR/LF
+// included) into one byte buffer. Dispatching an event is two array
+// lookups and a single socket write, whether the bindings came from a
+// JSON file or the built-in constexpr table.
+class BindingSet
+{
+public:
+    struct Entry
+    {
+        uint8_t chip; // index in the GPIOBank
+        uint8_t port;
+        uint8_t bit;
+        Trigger trigger;
+        uint32_t label; // offsets into the byte buffer
+        uint32_t command;
+        uint16_t commandLength; // zero for log-only bindings
+    };
+
+    // <chips> in InputWord order, as added to the GPIOBank. <reserved>
+    // pins (lamps, encoders) are refused as switch bindings.
+    BindingSet(const std::vector<uint8_t>& chips, const std::vector<PinRef>& reserved);
+
+    // the same checks as the constexpr table, at load time
+    bool add(PinRef pin, Trigger trigger, const std::string& label, const std::string& commandLine, std::string& error);
+
+    template <size_t N>
+    bool addTable(const PinBinding (&table)[N], std::string& error)
+    {
+        for (const PinBinding& b : table) {
+            std::string line;
+            if (b.action == BindingAction::Write) {
+                line = b.target;
+            } else if (b.action == BindingAction::Property) {
+                line = std::string("set ") + b.target + " " + b.value;
+            }
+
+            if (!add(b.pin, b.trigger, b.label, line, error)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // a JSON array of {"label", "address", "port", "bit", "trigger",
+    // "command"}; <source> prefixes error messages
+    bool addJSON(const JSONValue& bindings, const std::string& source, std::string& error);
+
+    const Entry* find(const InputEvent& ev) const
+    {
+        const int16_t index = ev.state ? _onHigh[ev.bit] : _onLow[ev.bit];
+        return (index < 0) ? nullptr : &_entries[index];
+    }
+
+    const char* label(const Entry& e) const
+    {
+        return _bytes.data() + e.label;
+    }
+
+    const char* command(const Entry& e) const
+    {
+        return _bytes.data() + e.command;
+    }
+
+    InputWord rising() const
+    {
+        return _rising;
+    }
+
+    InputWord falling() const
+    {
+        return _falling;
+    }
+
+    size_t size() const
+    {
+        return _entries.size();
+    }
+private:
+    std::vector<uint8_t> _chips;
+    InputWord _reserved = 0;
+
+    std::vector<Entry> _entries;
+    std::vector<char> _bytes;
+    int16_t _onHigh[InputWordBits];
+    int16_t _onLow[InputWordBits];
+    InputWord _rising = 0;
+    InputWord _falling = 0;
+};
+
+// a number, or a hex string such as an address, from a JSON object
+bool readJSONInt(const JSONValue& object, const char* key, int& result, std::string& error);
+
+// "address", "port" and "bit" of a JSON object
+bool readJSONPin(const JSONValue& object, PinRef& pin, std::string& error);
+
+#endif
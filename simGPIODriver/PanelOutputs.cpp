@@ -0,0 +1,66 @@
+#include "PanelOutputs.h"
+
+#include "LEDDriver.h"
+#include "LampFader.h"
+
+GPIOLampSink::GPIOLampSink(GPIOBank& bank) :
+    _bank(bank)
+{
+}
+
+LampRef GPIOLampSink::addLamp(OutputPin pin)
+{
+    _pins.push_back(pin);
+    _wanted.push_back(false);
+    _sent.push_back(false);
+    return LampRef{this, static_cast<unsigned int>(_pins.size() - 1)};
+}
+
+void GPIOLampSink::setLamp(unsigned int channel, bool on)
+{
+    _wanted.at(channel) = on;
+}
+
+unsigned int GPIOLampSink::commit()
+{
+    uint16_t ports = 0; // bit per chip and port
+    for (size_t i = 0; i < _pins.size(); ++i) {
+        if (_wanted[i] == _sent[i]) {
+            continue;
+        }
+
+        _bank.setOutput(_pins[i], _wanted[i]);
+        _sent[i] = _wanted[i];
+        ports |= 1u << (_pins[i].chip * 2 + _pins[i].port);
+    }
+
+    return __builtin_popcount(ports);
+}
+
+PCA9622LampSink::PCA9622LampSink(LEDDriver& driver, LampFader* fader) :
+    _driver(driver),
+    _fader(fader)
+{
+}
+
+void PCA9622LampSink::setLamp(unsigned int channel, bool on)
+{
+    if (_fader) {
+        _fader->setLamp(channel, on);
+    } else {
+        _driver.setLamp(channel, on ? LampMode::On : LampMode::Off);
+    }
+}
+
+unsigned int PCA9622LampSink::commit()
+{
+    if (_fader) {
+        return _fader->tick() ? 1 : 0;
+    }
+
+    if (!_driver.dirty()) {
+        return 0;
+    }
+
+    return _driver.commit() ? 1 : 0;
+}
@@ -0,0 +1,66 @@
+#ifndef PANEL_OUTPUTS_H
+#define PANEL_OUTPUTS_H
+
+#include <vector>
+
+#include "OutputSink.h"
+#include "GPIO.h"
+
+class LEDDriver;
+class LampFader;
+
+// lamps on expander outputs; channels in addLamp() order. commit() only
+// stages the bank's port shadows: the scanner threads write the changed
+// ports with their next scan, so the stats count staged ports and the
+// time to stage them, not bus writes.
+class GPIOLampSink : public OutputSink
+{
+public:
+    explicit GPIOLampSink(GPIOBank& bank);
+
+    LampRef addLamp(OutputPin pin);
+
+    std::string name() const override
+    {
+        return "MCP23017";
+    }
+
+    void setLamp(unsigned int channel, bool on) override;
+    unsigned int commit() override;
+
+    const char* commitUnit() const override
+    {
+        return "staged ports";
+    }
+private:
+    GPIOBank& _bank;
+    std::vector<OutputPin> _pins;
+    std::vector<bool> _wanted;
+    std::vector<bool> _sent;
+};
+
+// lamps on the PCA9622 channels, faded when <fader> is given; each
+// commit is at most one burst
+class PCA9622LampSink : public OutputSink
+{
+public:
+    PCA9622LampSink(LEDDriver& driver, LampFader* fader = nullptr);
+
+    LampRef lamp(unsigned int channel)
+    {
+        return LampRef{this, channel};
+    }
+
+    std::string name() const override
+    {
+        return "PCA9622";
+    }
+
+    void setLamp(unsigned int channel, bool on) override;
+    unsigned int commit() override;
+private:
+    LEDDriver& _driver;
+    LampFader* _fader;
+};
+
+#endif
@@ -0,0 +1,164 @@
+#include "StepperDriver.h"
+
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+
+#include "Adafruit_PWMServoDriver.h"
+
+using namespace std::chrono;
+
+const double MicrostepsPerDegree = StepperDriver::MicrostepsPerCycle / StepperDriver::DegreesPerCycle;
+
+// slow enough not to bounce off the end stop while homing
+const double HomingSpeed = 90.0; // degrees per second
+
+// below the kernel's RT throttling, above everything else in the driver
+const int SteppingPriority = 10;
+
+StepperDriver::StepperDriver(Adafruit_PWMServoDriver& chip, unsigned int rateHz) :
+    PWMTicker(chip, rateHz),
+    _dt(1.0 / rateHz)
+{
+    for (unsigned int i = 0; i < MicrostepsPerCycle; ++i) {
+        _sine[i] = static_cast<int16_t>(std::lround(4095 * std::sin(2 * M_PI * i / MicrostepsPerCycle)));
+    }
+}
+
+StepperDriver::~StepperDriver()
+{
+    stop();
+}
+
+unsigned int StepperDriver::addStepper(const StepperGaugeConfig& config)
+{
+    std::unique_ptr<Stepper> s(new Stepper);
+    s->channel = config.channel;
+    s->min = config.min;
+    s->scale = config.degrees * MicrostepsPerDegree / (config.max - config.min);
+    s->travel = static_cast<int32_t>(std::lround(config.degrees * MicrostepsPerDegree));
+    s->acceleration = config.acceleration * MicrostepsPerDegree;
+
+    // a coil must not turn half an electrical cycle or more between two
+    // ticks, or the rotor follows the wrong way and loses steps
+    const double fastest = 0.9 * (MicrostepsPerCycle / 2) / _dt;
+    s->maxSpeed = config.maxSpeed * MicrostepsPerDegree;
+    if (s->maxSpeed > fastest) {
+        std::cerr << "stepper " << config.name << ": max speed limited to "
+                  << (fastest / MicrostepsPerDegree) << " deg/sec at this tick rate" << std::endl;
+        s->maxSpeed = fastest;
+    }
+
+    // start past the full sweep, so homing reaches the stop from anywhere
+    s->position = s->travel + MicrostepsPerCycle * 2;
+    _steppers.push_back(std::move(s));
+    return _steppers.size() - 1;
+}
+
+void StepperDriver::setTarget(unsigned int stepper, double propertyValue)
+{
+    Stepper& s = *_steppers[stepper];
+    const double microsteps = (propertyValue - s.min) * s.scale;
+    const int32_t target = std::isnan(microsteps) ? 0 :
+        static_cast<int32_t>(std::lround(std::min(std::max(microsteps, 0.0), double(s.travel))));
+    s.target.store(target, std::memory_order_relaxed);
+}
+
+void StepperDriver::start()
+{
+    _due = steady_clock::now() + _period;
+
+    // late ticks show up as uneven needle speed, so ask for a real-time
+    // slot; without the privilege it still runs, with more jitter
+    if (!PWMTicker::start(SteppingPriority)) {
+        std::cerr << "stepper thread runs without real-time priority" << std::endl;
+    }
+}
+
+// one profile step toward <target>: accelerate to <maxSpeed>, and brake
+// in time to stop there. True once at rest on the target.
+bool StepperDriver::move(Stepper& s, double target, double maxSpeed)
+{
+    const double remaining = target - s.position;
+    const double dv = s.acceleration * _dt;
+    if ((std::fabs(remaining) < 0.5) && (std::fabs(s.velocity) <= dv)) {
+        s.position = target;
+        s.velocity = 0.0;
+        return true;
+    }
+
+    const double stopping = std::sqrt(2.0 * s.acceleration * std::fabs(remaining));
+    const double wanted = std::copysign(std::min(maxSpeed, stopping), remaining);
+    s.velocity += std::min(std::max(wanted - s.velocity, -dv), dv);
+    s.position += s.velocity * _dt;
+
+    // stepped past the target: settle on it rather than oscillate
+    if ((target - s.position) * remaining < 0.0) {
+        s.position = target;
+        s.velocity = 0.0;
+    }
+    return false;
+}
+
+void StepperDriver::stageCoils(const Stepper& s, int32_t microstep)
+{
+    const unsigned int phase = ((microstep % int32_t(MicrostepsPerCycle)) + MicrostepsPerCycle) % MicrostepsPerCycle;
+    const int16_t coils[2] = {_sine[(phase + MicrostepsPerCycle / 4) % MicrostepsPerCycle], _sine[phase]};
+
+    // each coil's current flows one way or the other through its pair of
+    // outputs: PWM on one, the other held fully off
+    for (unsigned int c = 0; c < 2; ++c) {
+        const uint8_t forward = s.channel + c * 2;
+        const uint16_t duty = static_cast<uint16_t>(std::abs(coils[c]));
+        const uint16_t off = duty ? duty : 0x1000;
+        _chip.stagePWM(forward, 0, (coils[c] >= 0) ? off : 0x1000);
+        _chip.stagePWM(forward + 1, 0, (coils[c] < 0) ? off : 0x1000);
+    }
+}
+
+void StepperDriver::tick(uint64_t expirations)
+{
+    const auto now = steady_clock::now();
+    const int64_t jitter = duration_cast<nanoseconds>(now - _due).count();
+    _due += _period * expirations;
+
+    _jitterSamples.fetch_add(1, std::memory_order_relaxed);
+    _jitterSumNsec.fetch_add(std::abs(jitter), std::memory_order_relaxed);
+    if (std::abs(jitter) > _maxJitterNsec.load(std::memory_order_relaxed)) {
+        _maxJitterNsec.store(std::abs(jitter), std::memory_order_relaxed);
+    }
+
+    for (auto& s : _steppers) {
+        if (s->homed.load(std::memory_order_relaxed)) {
+            move(*s, s->target.load(std::memory_order_relaxed), s->maxSpeed);
+        } else if (move(*s, 0.0, HomingSpeed * MicrostepsPerDegree)) {
+            s->homed.store(true, std::memory_order_relaxed);
+        }
+
+        const int32_t microstep = static_cast<int32_t>(std::lround(s->position));
+        if (microstep == s->written) {
+            continue;
+        }
+
+        stageCoils(*s, microstep);
+        s->written = microstep;
+    }
+
+    commitStaged();
+}
+
+void StepperDriver::printStats(std::ostream& os)
+{
+    const uint64_t ticks = _jitterSamples.exchange(0);
+    const int64_t jitterSum = _jitterSumNsec.exchange(0);
+    unsigned int homed = 0;
+    for (const auto& s : _steppers) {
+        homed += s->homed.load(std::memory_order_relaxed) ? 1 : 0;
+    }
+
+    os << "Steppers: ";
+    printRates(os);
+    os << ", tick jitter mean " << (ticks ? jitterSum / int64_t(ticks) / 1000 : 0)
+       << " max " << (_maxJitterNsec.exchange(0) / 1000) << " usec"
+       << ", homed " << homed << "/" << _steppers.size() << std::endl;
+}
@@ -0,0 +1,76 @@
+#ifndef STEPPER_DRIVER_H
+#define STEPPER_DRIVER_H
+
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+#include "PWMTicker.h"
+#include "GaugeCalibration.h"
+
+// Drives X27-style stepper gauges from the coils, microstepping them
+// with sine and cosine PWM on a PCA9685, from a dedicated thread at a
+// fixed rate. Each tick moves every needle along an acceleration-limited
+// profile toward its latest target and commits the changed coil duties
+// of all steppers as one auto-increment burst. At start the needles are
+// driven against their end stop to find zero, as the motors have no
+// position feedback.
+class StepperDriver : public PWMTicker
+{
+public:
+    // an X27 partial step is 1/3 degree, six of them an electrical cycle
+    static constexpr double DegreesPerCycle = 2.0;
+    static const unsigned int MicrostepsPerCycle = 64;
+
+    StepperDriver(Adafruit_PWMServoDriver& chip, unsigned int rateHz = 250);
+    ~StepperDriver() override;
+
+    // returns the stepper index; call before start()
+    unsigned int addStepper(const StepperGaugeConfig& config);
+
+    // a raw property value, from any thread; the needle goes there once
+    // homed
+    void setTarget(unsigned int stepper, double propertyValue);
+
+    // with real-time priority when permitted
+    void start();
+
+    void printStats(std::ostream& os);
+private:
+    struct Stepper
+    {
+        uint8_t channel;
+        double min;
+        double scale; // microsteps per property unit
+        int32_t travel; // microsteps
+        double maxSpeed; // microsteps per second
+        double acceleration; // microsteps per second squared
+        std::atomic<int32_t> target{0};
+        std::atomic<bool> homed{false};
+
+        // owned by the stepping thread
+        double position;
+        double velocity = 0.0;
+        int32_t written = INT32_MIN; // the microstep last staged
+    };
+
+    void tick(uint64_t expirations) override;
+    bool move(Stepper& s, double target, double maxSpeed);
+    void stageCoils(const Stepper& s, int32_t microstep);
+
+    const double _dt;
+    int16_t _sine[MicrostepsPerCycle]; // -4095..4095
+    std::vector<std::unique_ptr<Stepper>> _steppers;
+
+    std::chrono::steady_clock::time_point _due; // of the next tick
+
+    // written by the stepping thread
+    std::atomic<uint64_t> _jitterSamples{0};
+    std::atomic<int64_t> _jitterSumNsec{0};
+    std::atomic<int64_t> _maxJitterNsec{0};
+};
+
+#endif
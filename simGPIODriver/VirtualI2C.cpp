@@ -0,0 +1,635 @@
+#include "VirtualI2C.h"
+
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <algorithm>
+#include <cassert>
+
+#include <errno.h>
+
+#include "LEDDriver.h" // PCA9622_STATE_*
+
+using namespace std::chrono;
+
+void VirtualI2CDevice::write(const uint8_t* data, unsigned int length)
+{
+    if (length == 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> g(_mutex);
+    _pointer = selectRegister(data[0]);
+    for (unsigned int i=1; i < length; ++i) {
+        writeRegister(_pointer, data[i]);
+        _pointer = nextRegister(_pointer);
+    }
+}
+
+void VirtualI2CDevice::read(uint8_t* data, unsigned int length)
+{
+    std::lock_guard<std::mutex> g(_mutex);
+    for (unsigned int i=0; i < length; ++i) {
+        data[i] = readRegister(_pointer);
+        _pointer = nextRegister(_pointer);
+    }
+}
+
+uint8_t VirtualI2CDevice::registerValue(uint8_t reg) const
+{
+    std::lock_guard<std::mutex> g(_mutex);
+    return const_cast<VirtualI2CDevice*>(this)->readRegister(reg);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+enum MCP23017Register
+{
+    IODIRA = 0x00,
+    IPOLA = 0x02,
+    GPINTENA = 0x04,
+    DEFVALA = 0x06,
+    INTCONA = 0x08,
+    IOCONA = 0x0A,
+    IOCONB = 0x0B,
+    GPPUA = 0x0C,
+    INTFA = 0x0E,
+    INTCAPA = 0x10,
+    GPIOA = 0x12,
+    GPIOB = 0x13,
+    OLATA = 0x14,
+    OLATB = 0x15,
+    MCP23017_REGISTER_COUNT
+};
+
+const uint8_t IOCON_BANK = 0x80;
+const uint8_t IOCON_MIRROR = 0x40;
+const uint8_t IOCON_SEQOP = 0x20;
+
+VirtualMCP23017::VirtualMCP23017()
+{
+    _regs[IODIRA] = 0xff;
+    _regs[IODIRA + 1] = 0xff;
+}
+
+uint16_t VirtualMCP23017::pair(uint8_t regA) const
+{
+    return _regs[regA] | (_regs[regA + 1] << 8);
+}
+
+uint16_t VirtualMCP23017::pinLevels() const
+{
+    // undriven inputs float low unless their pull-up is on
+    const uint16_t inputs = (_levels & _driven) | (pair(GPPUA) & ~_driven);
+    const uint16_t dir = pair(IODIRA);
+    return (inputs & dir) | (pair(OLATA) & ~dir);
+}
+
+void VirtualMCP23017::updateInterrupts(uint16_t before)
+{
+    const uint16_t now = pinLevels();
+    const uint16_t enabled = pair(GPINTENA) & pair(IODIRA);
+    const uint16_t intcon = pair(INTCONA);
+    const uint16_t fired = enabled & ((~intcon & (now ^ before)) | (intcon & (now ^ pair(DEFVALA))));
+    const uint16_t gpio = now ^ (pair(IPOLA) & pair(IODIRA));
+
+    for (uint8_t port = 0; port < 2; ++port) {
+        const uint8_t f = fired >> (port * 8);
+        if (f == 0) {
+            continue;
+        }
+
+        // INTCAP holds the port as of the first unserviced interrupt
+        if (_regs[INTFA + port] == 0) {
+            _regs[INTCAPA + port] = gpio >> (port * 8);
+        }
+        _regs[INTFA + port] |= f;
+    }
+}
+
+void VirtualMCP23017::setPin(uint8_t pin, bool level)
+{
+    assert((pin >= 1) && (pin <= 16));
+    std::lock_guard<std::mutex> g(_mutex);
+    const uint16_t before = pinLevels();
+    const uint16_t mask = 1 << (pin - 1);
+    _driven |= mask;
+    _levels = level ? (_levels | mask) : (_levels & ~mask);
+    updateInterrupts(before);
+}
+
+void VirtualMCP23017::releasePin(uint8_t pin)
+{
+    assert((pin >= 1) && (pin <= 16));
+    std::lock_guard<std::mutex> g(_mutex);
+    const uint16_t before = pinLevels();
+    _driven &= ~(1 << (pin - 1));
+    updateInterrupts(before);
+}
+
+uint16_t VirtualMCP23017::outputs() const
+{
+    std::lock_guard<std::mutex> g(_mutex);
+    return pair(OLATA);
+}
+
+bool VirtualMCP23017::interruptPending(uint8_t port) const
+{
+    std::lock_guard<std::mutex> g(_mutex);
+    if (_regs[IOCONA] & IOCON_MIRROR) {
+        return (_regs[INTFA] | _regs[INTFA + 1]) != 0;
+    }
+
+    return _regs[INTFA + port] != 0;
+}
+
+uint8_t VirtualMCP23017::readRegister(uint8_t reg)
+{
+    if (reg >= MCP23017_REGISTER_COUNT) {
+        return 0;
+    }
+
+    const uint8_t port = reg & 1;
+    switch (reg) {
+    case GPIOA:
+    case GPIOB: {
+        const uint16_t gpio = pinLevels() ^ (pair(IPOLA) & pair(IODIRA));
+        _regs[INTFA + port] = 0; // reading the port clears its interrupt
+        return gpio >> (port * 8);
+    }
+
+    case INTCAPA:
+    case INTCAPA + 1:
+        _regs[INTFA + port] = 0;
+        return _regs[reg];
+
+    case IOCONB:
+        return _regs[IOCONA];
+
+    default:
+        return _regs[reg];
+    }
+}
+
+void VirtualMCP23017::writeRegister(uint8_t reg, uint8_t value)
+{
+    if (reg >= MCP23017_REGISTER_COUNT) {
+        return;
+    }
+
+    const uint16_t before = pinLevels();
+    switch (reg) {
+    case INTFA:
+    case INTFA + 1:
+    case INTCAPA:
+    case INTCAPA + 1:
+        return; // read-only
+
+    case IOCONA:
+    case IOCONB:
+        // only the BANK = 0 register map is modelled
+        _regs[IOCONA] = value & ~IOCON_BANK;
+        break;
+
+    case GPIOA:
+    case GPIOB:
+        _regs[OLATA + (reg & 1)] = value;
+        break;
+
+    default:
+        _regs[reg] = value;
+    }
+
+    updateInterrupts(before);
+}
+
+uint8_t VirtualMCP23017::nextRegister(uint8_t reg) const
+{
+    // with sequential operation disabled the pointer toggles within the
+    // A/B pair, otherwise it walks the whole map
+    if (_regs[IOCONA] & IOCON_SEQOP) {
+        return reg ^ 1;
+    }
+
+    return (reg + 1) % MCP23017_REGISTER_COUNT;
+}
+
+void VirtualMCP23017::dump(std::ostream& os) const
+{
+    std::lock_guard<std::mutex> g(_mutex);
+    os << std::hex << std::setfill('0')
+       << "IODIR " << std::setw(4) << pair(IODIRA)
+       << " pins " << std::setw(4) << pinLevels()
+       << " OLAT " << std::setw(4) << pair(OLATA)
+       << " INTF " << std::setw(4) << pair(INTFA)
+       << std::dec << std::setfill(' ');
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+enum PCA9622Register
+{
+    PCA9622_MODE1 = 0x00,
+    PCA9622_MODE2 = 0x01,
+    PCA9622_PWM0 = 0x02,
+    PCA9622_PWM15 = 0x11,
+    PCA9622_GRPPWM = 0x12,
+    PCA9622_GRPFREQ = 0x13,
+    PCA9622_LEDOUT0 = 0x14,
+    PCA9622_SUBADR1 = 0x18,
+    PCA9622_ALLCALLADR = 0x1B,
+    PCA9622_REGISTER_COUNT
+};
+
+const uint8_t PCA9622_AI2 = 0x80;
+const uint8_t PCA9622_AI1 = 0x40;
+const uint8_t PCA9622_AI0 = 0x20;
+const uint8_t PCA9622_DMBLNK = 0x20;
+
+VirtualPCA9622::VirtualPCA9622()
+{
+    _regs[PCA9622_MODE1] = 0x11; // sleeping, responds to all-call
+    _regs[PCA9622_MODE2] = 0x05;
+    _regs[PCA9622_GRPPWM] = 0xff;
+    _regs[PCA9622_SUBADR1] = 0xe2;
+    _regs[PCA9622_SUBADR1 + 1] = 0xe4;
+    _regs[PCA9622_SUBADR1 + 2] = 0xe8;
+    _regs[PCA9622_ALLCALLADR] = 0xe0;
+}
+
+uint8_t VirtualPCA9622::selectRegister(uint8_t pointerByte)
+{
+    // the top three bits of the control byte select auto-increment
+    _control = pointerByte & (PCA9622_AI2 | PCA9622_AI1 | PCA9622_AI0);
+    return pointerByte & 0x1f;
+}
+
+uint8_t VirtualPCA9622::readRegister(uint8_t reg)
+{
+    if (reg >= PCA9622_REGISTER_COUNT) {
+        return 0;
+    }
+
+    if (reg == PCA9622_MODE1) {
+        return (_regs[reg] & 0x1f) | _control;
+    }
+
+    return _regs[reg];
+}
+
+void VirtualPCA9622::writeRegister(uint8_t reg, uint8_t value)
+{
+    if (reg >= PCA9622_REGISTER_COUNT) {
+        return;
+    }
+
+    if (reg == PCA9622_MODE1) {
+        value &= 0x1f; // AI bits are read-only
+    }
+
+    _regs[reg] = value;
+}
+
+uint8_t VirtualPCA9622::nextRegister(uint8_t reg) const
+{
+    switch (_control) {
+    case PCA9622_AI2: // everything
+        return (reg >= PCA9622_ALLCALLADR) ? PCA9622_MODE1 : reg + 1;
+    case PCA9622_AI2 | PCA9622_AI0: // individual brightness only
+        return (reg >= PCA9622_PWM15 || reg < PCA9622_PWM0) ? PCA9622_PWM0 : reg + 1;
+    case PCA9622_AI2 | PCA9622_AI1: // global control only
+        return (reg == PCA9622_GRPPWM) ? PCA9622_GRPFREQ : PCA9622_GRPPWM;
+    case PCA9622_AI2 | PCA9622_AI1 | PCA9622_AI0: // brightness and global
+        return (reg >= PCA9622_GRPFREQ || reg < PCA9622_PWM0) ? PCA9622_PWM0 : reg + 1;
+    default:
+        return reg;
+    }
+}
+
+uint8_t VirtualPCA9622::ledState(uint8_t num) const
+{
+    std::lock_guard<std::mutex> g(_mutex);
+    return (_regs[PCA9622_LEDOUT0 + (num >> 2)] >> ((num & 0x3) * 2)) & 0x3;
+}
+
+uint8_t VirtualPCA9622::brightness(uint8_t num) const
+{
+    const uint8_t state = ledState(num);
+
+    std::lock_guard<std::mutex> g(_mutex);
+    const uint8_t pwm = _regs[PCA9622_PWM0 + num];
+    switch (state) {
+    case PCA9622_STATE_ON:
+        return 0xff;
+    case PCA9622_STATE_PWM:
+        return pwm;
+    case PCA9622_STATE_PWM_GROUP:
+        if (_regs[PCA9622_MODE2] & PCA9622_DMBLNK) {
+            return pwm; // blinking: report the on-phase level
+        }
+        return (pwm * _regs[PCA9622_GRPPWM]) / 255;
+    default:
+        return 0;
+    }
+}
+
+void VirtualPCA9622::dump(std::ostream& os) const
+{
+    for (uint8_t i=0; i < 16; ++i) {
+        os << (i ? " " : "") << static_cast<int>(brightness(i));
+    }
+
+    std::lock_guard<std::mutex> g(_mutex);
+    if (_regs[PCA9622_MODE2] & PCA9622_DMBLNK) {
+        os << " blink " << (_regs[PCA9622_GRPFREQ] + 1) / 24.0 << "s "
+           << (_regs[PCA9622_GRPPWM] * 100) / 256 << "%";
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+enum PCA9685Register
+{
+    PCA9685_MODE1_REG = 0x00,
+    PCA9685_MODE2_REG = 0x01,
+    PCA9685_SUBADR1_REG = 0x02,
+    PCA9685_ALLCALLADR_REG = 0x05,
+    PCA9685_LED0 = 0x06,
+    PCA9685_ALL_LED = 0xFA,
+    PCA9685_PRESCALE_REG = 0xFE
+};
+
+const uint8_t PCA9685_RESTART = 0x80;
+const uint8_t PCA9685_AI = 0x20;
+const uint8_t PCA9685_SLEEP = 0x10;
+const uint8_t PCA9685_FULL = 0x10; // bit 4 of ON_H / OFF_H
+
+VirtualPCA9685::VirtualPCA9685()
+{
+    _regs[PCA9685_MODE1_REG] = 0x11;
+    _regs[PCA9685_MODE2_REG] = 0x04;
+    _regs[PCA9685_SUBADR1_REG] = 0xe2;
+    _regs[PCA9685_SUBADR1_REG + 1] = 0xe4;
+    _regs[PCA9685_SUBADR1_REG + 2] = 0xe8;
+    _regs[PCA9685_ALLCALLADR_REG] = 0xe0;
+    _regs[PCA9685_PRESCALE_REG] = 0x1e;
+
+    // every channel powers up full-off
+    for (uint8_t i=0; i < 16; ++i) {
+        _regs[PCA9685_LED0 + i * 4 + 3] = PCA9685_FULL;
+    }
+}
+
+uint8_t VirtualPCA9685::readRegister(uint8_t reg)
+{
+    if (reg >= PCA9685_ALL_LED && reg < PCA9685_PRESCALE_REG) {
+        return 0; // ALL_LED reads back as zero
+    }
+
+    return _regs[reg];
+}
+
+void VirtualPCA9685::writeRegister(uint8_t reg, uint8_t value)
+{
+    if (reg == PCA9685_MODE1_REG) {
+        // writing RESTART clears it
+        if (value & PCA9685_RESTART) {
+            value &= ~PCA9685_RESTART;
+        }
+        _regs[reg] = value;
+        return;
+    }
+
+    if (reg == PCA9685_PRESCALE_REG) {
+        // the oscillator must be stopped to change the prescaler
+        if (_regs[PCA9685_MODE1_REG] & PCA9685_SLEEP) {
+            _regs[reg] = value;
+        }
+        return;
+    }
+
+    if (reg >= PCA9685_ALL_LED && reg < PCA9685_PRESCALE_REG) {
+        for (uint8_t i=0; i < 16; ++i) {
+            _regs[PCA9685_LED0 + i * 4 + (reg - PCA9685_ALL_LED)] = value;
+        }
+        return;
+    }
+
+    _regs[reg] = value;
+}
+
+uint8_t VirtualPCA9685::nextRegister(uint8_t reg) const
+{
+    if (_regs[PCA9685_MODE1_REG] & PCA9685_AI) {
+        return reg + 1;
+    }
+
+    return reg;
+}
+
+uint16_t VirtualPCA9685::channelTicks(uint8_t num) const
+{
+    const uint8_t* r = _regs + PCA9685_LED0 + num * 4;
+    if (r[3] & PCA9685_FULL) {
+        return 0; // full-off wins over full-on
+    }
+
+    if (r[1] & PCA9685_FULL) {
+        return 4096;
+    }
+
+    const uint16_t on = r[0] | ((r[1] & 0x0f) << 8);
+    const uint16_t off = r[2] | ((r[3] & 0x0f) << 8);
+    return (off - on + 4096) % 4096;
+}
+
+uint16_t VirtualPCA9685::dutyTicks(uint8_t num) const
+{
+    std::lock_guard<std::mutex> g(_mutex);
+    return channelTicks(num);
+}
+
+double VirtualPCA9685::frequencyHz() const
+{
+    std::lock_guard<std::mutex> g(_mutex);
+    return 25e6 / (4096.0 * (_regs[PCA9685_PRESCALE_REG] + 1));
+}
+
+void VirtualPCA9685::dump(std::ostream& os) const
+{
+    os << static_cast<int>(frequencyHz()) << " Hz";
+    std::lock_guard<std::mutex> g(_mutex);
+    for (uint8_t i=0; i < 16; ++i) {
+        os << " " << channelTicks(i);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+VirtualI2CAdapter::VirtualI2CAdapter(unsigned int clockHz) :
+    _clockHz(clockHz)
+{
+}
+
+VirtualI2CAdapter& VirtualI2CAdapter::install(int number, unsigned int clockHz)
+{
+    VirtualI2CAdapter* adapter = new VirtualI2CAdapter(clockHz);
+    const bool ok = I2CBus::install(number, std::unique_ptr<I2CAdapter>(adapter));
+    assert(ok);
+    (void) ok;
+    return *adapter;
+}
+
+void VirtualI2CAdapter::addDevice(uint8_t address, std::unique_ptr<VirtualI2CDevice> dev)
+{
+    assert(_devices.find(address) == _devices.end());
+    _devices[address] = std::move(dev);
+}
+
+VirtualI2CDevice* VirtualI2CAdapter::device(uint8_t address) const
+{
+    auto it = _devices.find(address);
+    return (it == _devices.end()) ? nullptr : it->second.get();
+}
+
+int VirtualI2CAdapter::transfer(I2CMessage* msgs, unsigned int count)
+{
+    const auto start = steady_clock::now();
+    applyStimuli();
+
+    // wire time: start or repeated-start, address byte, data bytes, each
+    // byte nine clocks including its ACK, and a final stop
+    unsigned int bits = 1;
+    int result = 0;
+    for (unsigned int i=0; i < count; ++i) {
+        bits += 1 + 9;
+
+        VirtualI2CDevice* dev = device(msgs[i].address);
+        if (!dev) {
+            result = EREMOTEIO; // address not acknowledged
+            break;
+        }
+
+        bits += 9 * msgs[i].length;
+        if (msgs[i].flags & I2C_MSG_READ) {
+            dev->read(msgs[i].data, msgs[i].length);
+        } else {
+            dev->write(msgs[i].data, msgs[i].length);
+        }
+    }
+
+    if (_clockHz > 0) {
+        const nanoseconds wire((bits * 1000000000ULL) / _clockHz);
+        std::this_thread::sleep_until(start + _overhead + wire);
+    }
+
+    return result;
+}
+
+// One stimulus per line, times relative to the first bus transfer:
+//
+//   # msec  address  pin(1-16)  level
+//   0       0x20     1          0
+//   250     0x20     1          1
+//   loop    500
+//
+// 'loop' replays the script with the given period.
+bool VirtualI2CAdapter::loadStimuli(const std::string& path)
+{
+    std::ifstream f(path);
+    if (!f) {
+        std::cerr << "can't open stimuli file " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    int lineNo = 0;
+    while (std::getline(f, line)) {
+        ++lineNo;
+        const size_t hash = line.find('#');
+        if (hash != std::string::npos) {
+            line.resize(hash);
+        }
+
+        std::istringstream ss(line);
+        std::string first;
+        if (!(ss >> first)) {
+            continue;
+        }
+
+        if (first == "loop") {
+            int period;
+            if (ss >> period) {
+                _stimuliLoop = milliseconds(period);
+                continue;
+            }
+        } else {
+            std::string address;
+            int pin, level;
+            if (ss >> address >> pin >> level) {
+                Stimulus s;
+                s.at = milliseconds(std::stoi(first));
+                s.address = std::stoi(address, nullptr, 0);
+                s.pin = pin;
+                s.level = level != 0;
+
+                VirtualMCP23017* mcp = dynamic_cast<VirtualMCP23017*>(device(s.address));
+                if (mcp && (pin >= 1) && (pin <= 16)) {
+                    _stimuli.push_back(s);
+                    continue;
+                }
+            }
+        }
+
+        std::cerr << path << ":" << lineNo << ": bad stimulus '" << line << "'" << std::endl;
+        return false;
+    }
+
+    std::stable_sort(_stimuli.begin(), _stimuli.end(), [](const Stimulus& a, const Stimulus& b) {
+        return a.at < b.at;
+    });
+    return true;
+}
+
+void VirtualI2CAdapter::applyStimuli()
+{
+    if (_stimuli.empty()) {
+        return;
+    }
+
+    const auto now = steady_clock::now();
+    if (!_stimuliStarted) {
+        _stimuliStart = now;
+        _stimuliStarted = true;
+    }
+
+    while (true) {
+        if (_nextStimulus == _stimuli.size()) {
+            if (_stimuliLoop.count() == 0) {
+                return;
+            }
+
+            _stimuliStart += _stimuliLoop;
+            _nextStimulus = 0;
+        }
+
+        const Stimulus& s = _stimuli[_nextStimulus];
+        if (now < _stimuliStart + s.at) {
+            return;
+        }
+
+        static_cast<VirtualMCP23017*>(device(s.address))->setPin(s.pin, s.level);
+        ++_nextStimulus;
+    }
+}
+
+void VirtualI2CAdapter::dump(std::ostream& os) const
+{
+    for (const auto& d : _devices) {
+        os << "  " << d.second->name() << " 0x" << std::hex << static_cast<int>(d.first) << std::dec << ": ";
+        d.second->dump(os);
+        os << std::endl;
+    }
+}
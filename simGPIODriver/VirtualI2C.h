@@ -0,0 +1,198 @@
+#ifndef VIRTUAL_I2C_H
+#define VIRTUAL_I2C_H
+
+#include <cstdint>
+#include <memory>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <ostream>
+
+#include "I2CBus.h"
+
+// A simulated chip on a VirtualI2CAdapter. Each message is handed over
+// whole: a write starts with the register pointer, a read continues from
+// wherever the pointer was left.
+class VirtualI2CDevice
+{
+public:
+    virtual ~VirtualI2CDevice() = default;
+
+    void write(const uint8_t* data, unsigned int length);
+    void read(uint8_t* data, unsigned int length);
+
+    virtual const char* name() const = 0;
+    virtual void dump(std::ostream& os) const = 0;
+
+    uint8_t registerValue(uint8_t reg) const;
+protected:
+    // strip any flag bits from the pointer byte
+    virtual uint8_t selectRegister(uint8_t pointerByte)
+    {
+        return pointerByte;
+    }
+
+    virtual uint8_t readRegister(uint8_t reg) = 0;
+    virtual void writeRegister(uint8_t reg, uint8_t value) = 0;
+
+    // pointer after a byte has been transferred
+    virtual uint8_t nextRegister(uint8_t reg) const = 0;
+
+    mutable std::mutex _mutex; // bus thread vs. inspection
+    uint8_t _pointer = 0;
+};
+
+// MCP23017 in IOCON.BANK = 0 layout, as ABE_IoPi configures it
+class VirtualMCP23017 : public VirtualI2CDevice
+{
+public:
+    VirtualMCP23017();
+
+    const char* name() const override
+    {
+        return "MCP23017";
+    }
+
+    // drive an input pin from outside, pin 1-16 as in ABE_IoPi
+    void setPin(uint8_t pin, bool level);
+    // stop driving it; the pin then follows its pull-up
+    void releasePin(uint8_t pin);
+
+    // output latch, port 1 in the high byte
+    uint16_t outputs() const;
+    bool interruptPending(uint8_t port) const;
+
+    void dump(std::ostream& os) const override;
+protected:
+    uint8_t readRegister(uint8_t reg) override;
+    void writeRegister(uint8_t reg, uint8_t value) override;
+    uint8_t nextRegister(uint8_t reg) const override;
+private:
+    uint16_t pinLevels() const;
+    uint16_t pair(uint8_t regA) const;
+    void updateInterrupts(uint16_t before);
+
+    uint8_t _regs[0x16] = {};
+    uint16_t _driven = 0;
+    uint16_t _levels = 0;
+};
+
+// PCA9622 16-channel LED driver
+class VirtualPCA9622 : public VirtualI2CDevice
+{
+public:
+    VirtualPCA9622();
+
+    const char* name() const override
+    {
+        return "PCA9622";
+    }
+
+    // LEDOUT state of a channel, one of PCA9622_STATE_*
+    uint8_t ledState(uint8_t num) const;
+    // effective duty 0-255 after LEDOUT, PWMx and group dimming
+    uint8_t brightness(uint8_t num) const;
+
+    void dump(std::ostream& os) const override;
+protected:
+    uint8_t selectRegister(uint8_t pointerByte) override;
+    uint8_t readRegister(uint8_t reg) override;
+    void writeRegister(uint8_t reg, uint8_t value) override;
+    uint8_t nextRegister(uint8_t reg) const override;
+private:
+    uint8_t _regs[0x1C] = {};
+    uint8_t _control = 0; // auto-increment flags from the pointer byte
+};
+
+// PCA9685 16-channel 12-bit PWM driver
+class VirtualPCA9685 : public VirtualI2CDevice
+{
+public:
+    VirtualPCA9685();
+
+    const char* name() const override
+    {
+        return "PCA9685";
+    }
+
+    // ticks out of 4096 the channel is high, full-on = 4096
+    uint16_t dutyTicks(uint8_t num) const;
+    double frequencyHz() const;
+
+    void dump(std::ostream& os) const override;
+protected:
+    uint8_t readRegister(uint8_t reg) override;
+    void writeRegister(uint8_t reg, uint8_t value) override;
+    uint8_t nextRegister(uint8_t reg) const override;
+private:
+    uint16_t channelTicks(uint8_t num) const;
+
+    uint8_t _regs[256] = {};
+};
+
+// An in-process I2C adapter: transfers go to the simulated chips and take
+// as long as they would on a real bus at the configured clock rate.
+class VirtualI2CAdapter : public I2CAdapter
+{
+public:
+    explicit VirtualI2CAdapter(unsigned int clockHz = 100000);
+
+    // create a virtual adapter and make it /dev/i2c-<number> for this
+    // process; must happen before any driver touches the bus
+    static VirtualI2CAdapter& install(int number, unsigned int clockHz);
+
+    template <class T>
+    T* add(uint8_t address)
+    {
+        T* dev = new T;
+        addDevice(address, std::unique_ptr<VirtualI2CDevice>(dev));
+        return dev;
+    }
+
+    void addDevice(uint8_t address, std::unique_ptr<VirtualI2CDevice> dev);
+
+    VirtualI2CDevice* device(uint8_t address) const;
+
+    // fixed cost of each transfer on top of the wire time, e.g. the
+    // kernel driver's setup and completion latency
+    void setTransferOverhead(std::chrono::microseconds overhead)
+    {
+        _overhead = overhead;
+    }
+
+    // scripted input changes, see loadStimuli() in VirtualI2C.cpp
+    bool loadStimuli(const std::string& path);
+
+    int transfer(I2CMessage* msgs, unsigned int count) override;
+
+    unsigned int maxMessages() const override
+    {
+        return 42;
+    }
+
+    void dump(std::ostream& os) const;
+private:
+    struct Stimulus
+    {
+        std::chrono::milliseconds at;
+        uint8_t address;
+        uint8_t pin;
+        bool level;
+    };
+
+    void applyStimuli();
+
+    unsigned int _clockHz;
+    std::chrono::microseconds _overhead{0};
+    std::map<uint8_t, std::unique_ptr<VirtualI2CDevice>> _devices;
+
+    std::vector<Stimulus> _stimuli;
+    std::chrono::milliseconds _stimuliLoop{0}; // zero = play once
+    size_t _nextStimulus = 0;
+    std::chrono::steady_clock::time_point _stimuliStart;
+    bool _stimuliStarted = false;
+};
+
+#endif
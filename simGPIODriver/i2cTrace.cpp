@@ -0,0 +1,54 @@
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <string>
+
+#include "I2CTrace.h"
+
+using namespace std;
+
+// summarize a trace written by simGPIODriver --trace:
+//   i2cTrace [--list] FILE
+
+int main(int argc, char* argv[])
+{
+    bool list = false;
+    string path;
+    for (int i=1; i<argc; ++i) {
+        const string arg = argv[i];
+        if (arg == "--list") {
+            list = true;
+        } else {
+            path = arg;
+        }
+    }
+
+    if (path.empty()) {
+        cerr << "usage: i2cTrace [--list] FILE" << endl;
+        return EXIT_FAILURE;
+    }
+
+    vector<I2CTraceRecord> records;
+    if (!I2CTracer::read(path, records)) {
+        cerr << "can't read I2C trace " << path << endl;
+        return EXIT_FAILURE;
+    }
+
+    if (list) {
+        for (const auto& r : records) {
+            cout << fixed << setprecision(1) << (r.startNsec / 1000.0) << " usec"
+                 << hex << " 0x" << static_cast<int>(r.address)
+                 << " reg 0x" << static_cast<int>(r.reg) << dec
+                 << ((r.flags & I2CTraceRecord::Read) ? " read " : " write ")
+                 << static_cast<int>(r.length) << " bytes, "
+                 << (r.durationNsec / 1000.0) << " usec"
+                 << ((r.flags & I2CTraceRecord::Batched) ? " batched" : "")
+                 << ((r.flags & I2CTraceRecord::Retry) ? " retry" : "")
+                 << ((r.flags & I2CTraceRecord::Error) ? " ERROR" : "")
+                 << endl;
+        }
+    }
+
+    I2CTracer::summarize(records, cout);
+    return EXIT_SUCCESS;
+}
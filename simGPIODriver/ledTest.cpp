@@ -10,28 +10,165 @@
 #include <unistd.h>
 #include <ctime>
 #include <signal.h>
+#include <chrono>
+#include <thread>
 
 #include "LEDDriver.h"
+#include "LampFader.h"
+#include "VirtualI2C.h"
 
 using namespace std;
 
 
 LEDDriver* ledDriver = nullptr;
+VirtualPCA9622* virtualChip = nullptr;
 
+void showState()
+{
+    if (virtualChip) {
+        virtualChip->dump(cout);
+        cout << endl;
+    }
+}
+
+// change every PWM and LEDOUT register, then write them out
+double framesPerSecond(bool burst, double seconds)
+{
+    using namespace std::chrono;
+    const auto start = steady_clock::now();
+    const auto end = start + duration<double>(seconds);
+
+    unsigned int frames = 0;
+    auto now = start;
+    while (now < end) {
+        const bool odd = frames & 1;
+        for (int i=0; i<16; ++i) {
+            ledDriver->setPWM(i, odd ? i : 255 - i);
+            ledDriver->setState(i, odd ? PCA9622_STATE_PWM : PCA9622_STATE_PWM_GROUP);
+        }
+
+        if (burst) {
+            ledDriver->commit();
+        } else {
+            ledDriver->flush();
+        }
+
+        ++frames;
+        now = steady_clock::now();
+    }
+
+    return frames / duration<double>(now - start).count();
+}
+
+void runThroughput(double seconds)
+{
+    const double perRegister = framesPerSecond(false, seconds);
+    const double burst = framesPerSecond(true, seconds);
+
+    cout << "full-frame updates (16 PWM + 4 LEDOUT registers):" << endl;
+    cout << "  per-register writes: " << perRegister << " frames/s (20 transactions/frame)" << endl;
+    cout << "  auto-increment burst: " << burst << " frames/s (1 transaction/frame)" << endl;
+    cout << "  speed-up: " << (burst / perRegister) << "x" << endl;
+}
+
+// toggle every lamp twice a second through the fader
+void runFade(double seconds)
+{
+    using namespace std::chrono;
+    LampFader fader(*ledDriver);
+    for (int i=0; i<16; ++i) {
+        fader.setFaded(i, true);
+    }
+
+    const auto start = steady_clock::now();
+    auto next = start;
+    bool on = false;
+    for (unsigned int tick = 0; steady_clock::now() - start < duration<double>(seconds); ++tick) {
+        if ((tick % 50) == 0) {
+            on = !on;
+            for (int i=0; i<16; ++i) {
+                fader.setLamp(i, on);
+            }
+        }
+
+        const bool changed = fader.tick();
+        if (virtualChip && changed && (tick < 100)) {
+            showState(); // the first warm-up and cool-down, tick by tick
+        }
+
+        if ((tick % 100) == 99) {
+            fader.printStats(cout);
+        }
+
+        next += fader.tickInterval();
+        std::this_thread::sleep_until(next);
+    }
+}
 
 int main(int argc, char* argv[])
 {
+    // ledTest [--virtual[=KHZ]] [--throughput[=SECONDS]] [--blink] [--fade[=SECONDS]]
+    //   --virtual : drive a simulated chip off the Pi
+    //   --throughput : time full-frame updates instead of chasing lamps
+    //   --blink : hardware-blink the even lamps, hold the odd ones steady
+    //   --fade : fade all lamps on and off with the incandescent curves
+    double throughputSeconds = 0.0;
+    double fadeSeconds = 0.0;
+    bool blink = false;
+    for (int i=1; i<argc; ++i) {
+        const string arg = argv[i];
+        if (arg.compare(0, 9, "--virtual") == 0) {
+            const int khz = (arg.size() > 10) ? stoi(arg.substr(10)) : 100;
+            virtualChip = VirtualI2CAdapter::install(1, khz * 1000).add<VirtualPCA9622>(0x31);
+        } else if (arg.compare(0, 12, "--throughput") == 0) {
+            throughputSeconds = (arg.size() > 13) ? stod(arg.substr(13)) : 2.0;
+        } else if (arg == "--blink") {
+            blink = true;
+        } else if (arg.compare(0, 6, "--fade") == 0) {
+            fadeSeconds = (arg.size() > 7) ? stod(arg.substr(7)) : 5.0;
+        }
+    }
+
     ledDriver = new LEDDriver(0x31); // I2C address
     ledDriver->begin();
 
+    if (throughputSeconds > 0.0) {
+        runThroughput(throughputSeconds);
+        showState();
+        return EXIT_SUCCESS;
+    }
+
+    if (fadeSeconds > 0.0) {
+        runFade(fadeSeconds);
+        return EXIT_SUCCESS;
+    }
+
+    if (blink) {
+        // one burst to set up; after that the chip flashes on its own
+        ledDriver->setBlinking(true, 1.0, 0.5);
+        for (int i=0; i<16; ++i) {
+            ledDriver->setLamp(i, (i & 1) ? LampMode::On : LampMode::Blink);
+        }
+        ledDriver->commit();
+
+        while (true) {
+            showState();
+            ::sleep(1);
+        }
+    }
+
     while (true) {
         for (int i=0; i<16; ++i) {
             ledDriver->setState(i, PCA9622_STATE_ON);
+            ledDriver->flush();
+            showState();
             ::sleep(1);
         }
 
          for (int i=0; i<16; ++i) {
             ledDriver->setState(i, PCA9622_STATE_OFF);
+            ledDriver->flush();
+            showState();
             ::sleep(1);
         }
     }
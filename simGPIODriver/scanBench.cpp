@@ -0,0 +1,71 @@
+#include <string>
+#include <iostream>
+#include <cstdlib>
+#include <chrono>
+#include <functional>
+
+#include "GPIO.h"
+#include "VirtualI2C.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// compare the old per-port input reads against the combined I2C_RDWR
+// transaction GPIOBank::scan() now uses. Run on the Pi with the panel
+// connected, or anywhere against the simulated chips:
+//   scanBench [--virtual[=KHZ]] [seconds per mode]
+
+static double runFor(double seconds, const std::function<void()>& fn)
+{
+    uint64_t count = 0;
+    const auto start = steady_clock::now();
+    const auto end = start + duration_cast<steady_clock::duration>(duration<double>(seconds));
+    auto now = start;
+    while (now < end) {
+        fn();
+        ++count;
+        now = steady_clock::now();
+    }
+
+    return count / duration_cast<duration<double>>(now - start).count();
+}
+
+int main(int argc, char* argv[])
+{
+    double seconds = 5.0;
+    for (int i=1; i<argc; ++i) {
+        const string arg = argv[i];
+        if (arg.compare(0, 9, "--virtual") == 0) {
+            const int khz = (arg.size() > 10) ? stoi(arg.substr(10)) : 100;
+            VirtualI2CAdapter& bus = VirtualI2CAdapter::install(1, khz * 1000);
+            for (uint8_t address : {0x20, 0x21, 0x22, 0x23}) {
+                bus.add<VirtualMCP23017>(address);
+            }
+        } else {
+            seconds = atof(argv[i]);
+        }
+    }
+
+    GPIOBank bank;
+    for (uint8_t address : {0x20, 0x21, 0x22, 0x23}) {
+        bank.addChip(address);
+    }
+    bank.open(); // no bindings: all pins stay as inputs
+
+    const double perPort = runFor(seconds, [&bank]() {
+        for (uint8_t address : {0x20, 0x21, 0x22, 0x23}) {
+            bank.chip(address).readInputs();
+        }
+    });
+
+    InputWord word;
+    const double combined = runFor(seconds, [&bank, &word]() {
+        bank.readAll(word);
+    });
+
+    cout << "per-port reads: " << perPort << " scans/sec" << endl;
+    cout << "combined read: " << combined << " scans/sec" << endl;
+    cout << "speedup: " << (combined / perPort) << "x" << endl;
+
+    return EXIT_SUCCESS;
+}
@@ -12,6 +12,8 @@
 #include <signal.h>
 
 #include "Adafruit_PWMServoDriver.h"
+#include "VirtualI2C.h"
+#include "GaugeCalibration.h"
 
 using namespace std;
 
@@ -25,28 +27,110 @@ using namespace std;
 #define SERVOMAX  600 // this is the 'maximum' pulse length count (out of 4096)
 
 Adafruit_PWMServoDriver* servoDriver = nullptr;
+VirtualPCA9685* virtualChip = nullptr;
 
-int positionsVec[] = {
-    150,
-	200, // 1 degree
-	240,
-	280, // 5 degree
-	320,
-	370, // 15 degree
-	405,
-	440,
-	480};
+void moveTo(uint8_t channel, uint16_t count)
+{
+    servoDriver->setPWM(channel, 0, count);
+    if (virtualChip) {
+        virtualChip->dump(cout);
+        cout << endl;
+    }
+}
+
+// Step through each gauge's detents, moving the servo until the needle
+// sits on the marking: empty line accepts, '+'/'-' nudge by one count
+// per character, a number sets the count, 'b' goes back a detent and 'q'
+// quits without saving.
+bool calibrate(GaugeCalibration& calibration)
+{
+    for (GaugeCurve& curve : calibration.curves()) {
+        cout << "Calibrating " << curve.name() << " on channel " << int(curve.channel()) << endl;
+        size_t p = 0;
+        while (p < curve.points().size()) {
+            const GaugeCurve::Point& point = curve.points()[p];
+            moveTo(curve.channel(), point.count);
+            cout << curve.name() << " " << point.label << " (" << point.value << "): count "
+                 << point.count << " > " << flush;
+
+            string line;
+            if (!getline(cin, line) || (line == "q")) {
+                return false;
+            }
+
+            if (line.empty()) {
+                ++p;
+            } else if (line == "b") {
+                p = (p > 0) ? p - 1 : 0;
+            } else if ((line[0] == '+') || (line[0] == '-')) {
+                const int step = (line[0] == '+') ? 1 : -1;
+                const int count = point.count + step * static_cast<int>(line.size());
+                curve.setCount(p, static_cast<uint16_t>(max(0, min(count, 4095))));
+            } else {
+                try {
+                    const int count = stoi(line);
+                    curve.setCount(p, static_cast<uint16_t>(max(0, min(count, 4095))));
+                } catch (exception&) {
+                    cout << "enter, +, -, a count, b or q" << endl;
+                }
+            }
+        }
+    }
+
+    return true;
+}
 
 int main(int argc, char* argv[])
 {
+    // servoTest [--virtual[=KHZ]] [--calibration=FILE] : cycle the detents
+    // servoTest [--virtual[=KHZ]] --calibrate=FILE : record them into FILE
+    string calibrationFile;
+    bool interactive = false;
+    for (int i=1; i<argc; ++i) {
+        const string arg = argv[i];
+        if (arg.compare(0, 9, "--virtual") == 0) {
+            const int khz = (arg.size() > 10) ? stoi(arg.substr(10)) : 100;
+            virtualChip = VirtualI2CAdapter::install(1, khz * 1000).add<VirtualPCA9685>(0x40);
+        } else if (arg.compare(0, 12, "--calibrate=") == 0) {
+            calibrationFile = arg.substr(12);
+            interactive = true;
+        } else if (arg.compare(0, 14, "--calibration=") == 0) {
+            calibrationFile = arg.substr(14);
+        }
+    }
+
+    // a new calibration starts from the built-in curves
+    GaugeCalibration calibration = GaugeCalibration::builtin();
+    string error;
+    if (!calibrationFile.empty() && (!interactive || (access(calibrationFile.c_str(), F_OK) == 0))
+        && !calibration.loadJSON(calibrationFile, error))
+    {
+        cerr << "failed to load calibration: " << error << endl;
+        return EXIT_FAILURE;
+    }
+
     servoDriver = new Adafruit_PWMServoDriver(0x40, 60.0); // I2C address
     servoDriver->begin();
 
+    if (interactive) {
+        if (!calibrate(calibration)) {
+            cout << "not saved" << endl;
+            return EXIT_FAILURE;
+        }
+        if (!calibration.saveJSON(calibrationFile, error)) {
+            cerr << error << endl;
+            return EXIT_FAILURE;
+        }
+        cout << "saved " << calibrationFile << endl;
+        return EXIT_SUCCESS;
+    }
 
     while (true) {
-        for (int i=0; i<9; ++i) {
-            servoDriver->setPWM(0, 0, positionsVec[i]);
-            ::sleep(2);
+        for (const GaugeCurve& curve : calibration.curves()) {
+            for (const GaugeCurve::Point& point : curve.points()) {
+                moveTo(curve.channel(), point.count);
+                ::sleep(2);
+            }
         }
     }
 
@@ -6,6 +6,11 @@
 #include <cassert>
 #include <algorithm>
 #include <exception>
+#include <sstream>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <cmath>
 
 #include <unistd.h>
 #include <ctime>
@@ -15,10 +20,38 @@
 
 #include "FGFSTelnetSocket.h"
 #include "GPIO.h"
+#include "GPIOScanner.h"
+#include "EventLoop.h"
 #include "LEDDriver.h"
+#include "I2CBus.h"
+#include "VirtualI2C.h"
+#include "Encoder.h"
+#include "BindingTable.h"
+#include "PanelBindings.h"
+#include "AircraftProfile.h"
+#include "OutputSink.h"
+#include "PanelOutputs.h"
+#include "LampFader.h"
+#include "Adafruit_PWMServoDriver.h"
+#include "GaugeDriver.h"
+#include "GaugeCalibration.h"
+#include "StepperDriver.h"
 
 using namespace std;
 
+// which /dev/i2c-<n> each board hangs off; chips on different buses are
+// scanned in parallel
+const int Gear_I2C_Bus = 1;
+const int AFDS_I2C_Bus = 1;
+const int MIP1_I2C_Bus = 1;
+const int MIP2_I2C_Bus = 1;
+const int Lamp_Driver_I2C_Bus = 1;
+const uint8_t Lamp_Driver_I2C_Address = 0x31;
+const int Servo_Driver_I2C_Bus = 1;
+const uint8_t Servo_Driver_I2C_Address = 0x40;
+const uint8_t Stepper_Driver_I2C_Address = 0x41;
+const float Stepper_PWM_Frequency = 1500.0; // near the PCA9685's fastest, to keep the coils quiet
+
 const uint8_t Gear_I2C_Address = 0x20;
 const uint8_t Gear_Lamp_Port = 0;
 const uint8_t Gear_Sixpack_Switch_Port = 1;
@@ -36,28 +69,62 @@ const uint8_t MIP2_Autobrake_Port = 0;
 const uint8_t MIP2_AFDS_Switch_Port = 1;
 
 LEDDriver* global_ledDriver = nullptr;
-bool global_testMode = false;
-
-#if defined(LINUX_BUILD)
-
-#include "Adafruit_PWMServoDriver.h"
-
-Adafruit_PWMServoDriver* servoDriver = nullptr;
+bool global_useLampDriver = false;
+LampFader* global_lampFader = nullptr;
+OutputSet global_outputs;
+GPIOLampSink* global_gpioLamps = nullptr;
+PCA9622LampSink* global_ledLamps = nullptr;
+bool global_useGauges = false;
+Adafruit_PWMServoDriver* global_servoDriver = nullptr;
+GaugeDriver* global_gauges = nullptr;
+Adafruit_PWMServoDriver* global_stepperChip = nullptr;
+StepperDriver* global_steppers = nullptr;
+std::string global_calibrationFile;
+GaugeCalibration global_calibration = GaugeCalibration::builtin();
+
+struct PropertyGauge
+{
+    const GaugeCurve* curve;
+    unsigned int gauge; // in global_gauges
+};
 
-void initGPIO()
+// the servo and stepper gauges following one property
+struct GaugeProperty
 {
+    std::string path; // as subscribed
+    std::vector<PropertyGauge> servos;
+    std::vector<unsigned int> steppers; // in global_steppers
+};
 
-//    servoDriver = new Adafruit_PWMServoDriver(0x40, 60); // I2C address
-//    servoDriver->begin();
-}
+std::unordered_map<std::string, GaugeProperty> global_gaugesByPath; // normalized
+std::vector<GPIOScanner*> global_scanners; // one per bus
+EventLoop* global_loop = nullptr;
+bool global_testMode = false;
+bool global_printStats = false;
+unsigned int global_scanRateHz = 500;
+unsigned int global_idleRateHz = 100;
+std::chrono::milliseconds global_idleAfter{2000};
+std::chrono::microseconds global_debounce = std::chrono::milliseconds(4);
+std::vector<std::pair<int, int>> global_interruptPins; // GPIO pin, I2C bus
+std::map<int, VirtualI2CAdapter*> global_virtualBuses;
+
+struct EncoderBinding
+{
+    const char* property;
+    double step; // per detent, before acceleration
+    int bus;
+    QuadratureEncoder* encoder;
+};
 
-#else
+std::vector<EncoderBinding> global_encoders;
+unsigned int global_virtualBusKHz = 0; // zero = real hardware
+std::string global_stimuliFile;
+std::string global_traceFile;
+std::set<int> global_tracedBuses;
+std::vector<std::string> global_profileFiles;
+std::vector<AircraftProfile*> global_profiles; // the first is the fallback
+const AircraftProfile* global_profile = nullptr;
 
-void initGPIO()
-{
-    std::cout << "dummy GPIO init"<< std::endl;
-}
-#endif
 
 
 
@@ -66,9 +133,16 @@ int fgfsPort = 5501;
 
 const int defaultReconnectBackoff = 4;
 const int keepAliveInterval = 10;
+const int statsInterval = 10;
+const auto encoderTickInterval = std::chrono::milliseconds(50);
+const auto panelDimmingInterval = std::chrono::milliseconds(50);
+const auto outputTickInterval = std::chrono::milliseconds(10); // the fader's 100 Hz
 
-double gearPositionNorm[3] = {0.0, 0.0, 0.0};
-double flapPositionNorm = 0.0;
+
+std::string global_dimmingProperty; // empty: no panel dimming
+double panelBrightnessNorm = 1.0;
+uint64_t panelDimmingUpdates = 0;
+uint64_t panelDimmingWrites = 0;
 
 const double gearDownAndLockedThreshold = 0.98;
 const double gearUpAndLockedThreshold = 0.02;
@@ -78,111 +152,84 @@ std::vector<std::string> lampNames = {
     "irs", "apu", "flt-cont", "elec"};
 
 FGFSTelnetSocket* global_fgSocket = nullptr;
-
-OutputBindingRef gearLamps[6];
-OutputBindingRef sixpackLamps[6];
-OutputBindingRef fireCautionLamps[2];
-OutputBindingRef afdsLamps[5];
-OutputBindingRef autobrakeLamps[4];
-
-void setupSubscriptions()
+int registeredSocketFd = -1;
+int reconnectBackoff = defaultReconnectBackoff;
+
+GPIOBank* global_gpio = nullptr;
+
+// order defines the layout of the InputWord
+constexpr uint8_t PanelChips[] = {Gear_I2C_Address, AFDS_I2C_Address, MIP1_I2C_Address, MIP2_I2C_Address};
+
+constexpr PinRef gearLampPins[6] = {
+    {Gear_I2C_Address, Gear_Lamp_Port, 0}, {Gear_I2C_Address, Gear_Lamp_Port, 1},
+    {Gear_I2C_Address, Gear_Lamp_Port, 2}, {Gear_I2C_Address, Gear_Lamp_Port, 3},
+    {Gear_I2C_Address, Gear_Lamp_Port, 4}, {Gear_I2C_Address, Gear_Lamp_Port, 5}};
+
+constexpr PinRef sixpackLampPins[6] = {
+    {AFDS_I2C_Address, Sixpack_Lamp_Port, 0}, {AFDS_I2C_Address, Sixpack_Lamp_Port, 1},
+    {AFDS_I2C_Address, Sixpack_Lamp_Port, 2}, {AFDS_I2C_Address, Sixpack_Lamp_Port, 3},
+    {AFDS_I2C_Address, Sixpack_Lamp_Port, 4}, {AFDS_I2C_Address, Sixpack_Lamp_Port, 5}};
+
+constexpr PinRef fireCautionLampPins[2] = {
+    {AFDS_I2C_Address, Sixpack_Lamp_Port, 6}, {AFDS_I2C_Address, Sixpack_Lamp_Port, 7}};
+
+constexpr PinRef afdsLampPins[5] = {
+    {AFDS_I2C_Address, AFDS_MIP_Lamp_Port, 3}, {AFDS_I2C_Address, AFDS_MIP_Lamp_Port, 4},
+    {AFDS_I2C_Address, AFDS_MIP_Lamp_Port, 5}, {AFDS_I2C_Address, AFDS_MIP_Lamp_Port, 6},
+    {AFDS_I2C_Address, AFDS_MIP_Lamp_Port, 7}};
+
+constexpr PinRef autobrakeLampPins[4] = {
+    {AFDS_I2C_Address, AFDS_MIP_Lamp_Port, 0}, {AFDS_I2C_Address, AFDS_MIP_Lamp_Port, 1},
+    {AFDS_I2C_Address, AFDS_MIP_Lamp_Port, 2},
+    {MIP2_I2C_Address, MIP2_AFDS_Switch_Port, 5}}; // odd pin out
+
+// N1 set encoder on bits 3 (A) and 2 (B), speed reference on 6 (A) and 7 (B)
+constexpr PinRef encoderPins[4] = {
+    {MIP1_I2C_Address, MIP1_N1_Port, 3}, {MIP1_I2C_Address, MIP1_N1_Port, 2},
+    {MIP1_I2C_Address, MIP1_Speeds_Port, 6}, {MIP1_I2C_Address, MIP1_Speeds_Port, 7}};
+
+LampRef gearLamps[6];
+LampRef sixpackLamps[6];
+LampRef fireCautionLamps[2];
+LampRef afdsLamps[5];
+LampRef autobrakeLamps[4];
+
+// the gauge and stepper threads move the needles; false if no gauge
+// follows <path>
+bool updateGauges(const std::string& path, const std::string& value)
 {
-    global_fgSocket->subscribe("/gear/gear[0]/position-norm");
-    global_fgSocket->subscribe("/gear/gear[1]/position-norm");
-    global_fgSocket->subscribe("/gear/gear[2]/position-norm");
-
-    for (auto s : lampNames) {
-        global_fgSocket->subscribe("/instrumentation/weu/outputs/" + s + "-lamp");
+    const auto it = global_gaugesByPath.find(AircraftProfile::normalizePath(path));
+    if (it == global_gaugesByPath.end()) {
+        return false;
     }
 
-    global_fgSocket->subscribe("/surface-positions/flap-pos-norm[0]");
-}
-
-void setWEULampBit(uint8_t index, bool b)
-{
-    if (index < 2) {
-        fireCautionLamps[index]->setState(b);
-    } else {
-        sixpackLamps[index - 2]->setState(b);
+    const double v = atof(value.c_str());
+    for (const PropertyGauge& g : it->second.servos) {
+        global_gauges->setTarget(g.gauge, g.curve->countFor(v));
     }
-}
-
-bool getInitialState()
-{
-    int attempts = 5;
-    bool ok;
-
-    assert(lampNames.size() == 8);
-
-    for (int attempt=0; attempt < attempts; ++attempt) {
-        bool attemptOk = true;
-        for (int i=0; i<3; ++i) {
-            ok = global_fgSocket->syncGetDouble("/gear/gear[" + to_string(i) + "]/position-norm",
-                                    gearPositionNorm[i]);
-            if (!ok)
-                attemptOk = false;
-        }
-
-        ok = global_fgSocket->syncGetDouble("/surface-positions/flap-pos-norm[0]", flapPositionNorm);
-        if (!ok)
-            attemptOk = false;
-
-        for (int i=0; i<8; ++i) {
-            bool b;
-            ok = global_fgSocket->syncGetBool("/instrumentation/weu/outputs/" + lampNames.at(i) + "-lamp", b);
-            if (!ok) {
-                attemptOk = false;
-                std::cerr << "failed to get initial state for:" << "/instrumentation/weu/outputs/" + lampNames.at(i) + "-lamp" << std::endl;
-            }
-            setWEULampBit(i, b);
-        }
-
-        if (attemptOk) { // all values in this attempt worked, we are done
-            return true;
-        }
-    } // of attempts
-
-    return false;
-}
-
-// map analogue gear positions to lamp discrete values
-void updateGearLampState()
-{
-    uint8_t offset = 0;
-    for (int i=0; i<3; ++i) {
-        const double p = gearPositionNorm[i];
-        bool isDownAndLocked = (p >= gearDownAndLockedThreshold);
-        bool gearUnsafe = (p > gearUpAndLockedThreshold) &&
-                (p <= gearDownAndLockedThreshold);
-
-        gearLamps[0 + offset]->setState(gearUnsafe);
-        gearLamps[1 + offset]->setState(isDownAndLocked);
-        offset += 2;
+    for (unsigned int stepper : it->second.steppers) {
+        global_steppers->setTarget(stepper, v);
     }
+    return true;
 }
 
-int pwmValueForFlapPos()
+// called at panelDimmingInterval, however often the property changes, so
+// a knob being turned costs at most one write per interval: GRPPWM, or
+// the dimmed lamps' own PWM while the driver is blinking
+void updatePanelDimming()
 {
-    if (flapPositionNorm <= 0.625) {
-        double normLow = flapPositionNorm / 0.625;
-        return 150 + static_cast<int>(normLow * 220);
+    if (!global_ledDriver) {
+        return;
     }
 
-    double normHigh = (flapPositionNorm - 0.625) / 0.375;
-    return 370 + static_cast<int>(normHigh * 110);
-}
-
-void updateFlapPosition()
-{
-    static int lastPWM = 0;
-    int pwm = pwmValueForFlapPos();
-    if (pwm == lastPWM)
+    const double norm = std::min(std::max(panelBrightnessNorm, 0.0), 1.0);
+    const uint8_t level = static_cast<uint8_t>(std::lround(norm * 255));
+    if (level == global_ledDriver->brightness()) {
         return;
+    }
 
-    lastPWM = pwm;
-#if defined(LINUX_BUILD)
-   // servoDriver->setPWM(0, 0, pwm);
-#endif
+    global_ledDriver->setBrightness(level); // written at the next output tick
+    ++panelDimmingWrites;
 }
 
 enum class SpecialLEDState
@@ -216,65 +263,133 @@ void setSpecialLEDState(SpecialLEDState state)
 #endif
 }
 
+const AircraftProfile* profileFor(const std::string& aircraft)
+{
+    for (const AircraftProfile* p : global_profiles) {
+        if (p->matches(aircraft)) {
+            return p;
+        }
+    }
+
+    std::cerr << "no profile for aircraft '" << aircraft << "', using "
+              << global_profiles.front()->name() << std::endl;
+    return global_profiles.front();
+}
+
+void pollHandler(const std::string& message);
+
+// the properties connectToFlightGear() subscribes for itself, whichever
+// profile is active: a profile switch must leave them alone
+bool isDriverProperty(const std::string& path)
+{
+    const std::string normalized = AircraftProfile::normalizePath(path);
+    return (normalized == "/sim/aircraft") || (global_gaugesByPath.count(normalized) > 0) ||
+        (!global_dimmingProperty.empty() && (normalized == AircraftProfile::normalizePath(global_dimmingProperty)));
+}
+
+// Make <next> the active profile. <subscribed> is the profile whose
+// properties FlightGear is currently sending, or nullptr on a fresh
+// connection. Only the difference is (un)subscribed, in one write, and
+// the new profile's initial values are fetched with pipelined gets.
+bool switchProfile(const AircraftProfile* next, const AircraftProfile* subscribed)
+{
+    const auto start = std::chrono::steady_clock::now();
+    const std::vector<std::string>& oldPaths = subscribed ? subscribed->subscriptions() : std::vector<std::string>();
+    const std::vector<std::string>& newPaths = next->subscriptions();
+
+    std::vector<std::string> lines;
+    for (const auto& path : oldPaths) {
+        if ((std::find(newPaths.begin(), newPaths.end(), path) == newPaths.end()) && !isDriverProperty(path)) {
+            lines.push_back("unsubscribe " + path);
+        }
+    }
+    const size_t unsubscribed = lines.size();
+    for (const auto& path : newPaths) {
+        if ((std::find(oldPaths.begin(), oldPaths.end(), path) == oldPaths.end()) && !isDriverProperty(path)) {
+            lines.push_back("subscribe " + path);
+        }
+    }
+
+    // from here on, switch events run the new bindings
+    const AircraftProfile* previous = global_profile;
+    global_profile = next;
+    global_gpio->setWatchedEdges(next->bindings().rising(), next->bindings().falling());
+
+    std::vector<std::string> values;
+    if (!global_fgSocket->writeLines(lines) || !global_fgSocket->syncGetMany(newPaths, values, pollHandler)) {
+        std::cerr << "failed to switch to profile " << next->name() << std::endl;
+        return false;
+    }
+
+    for (size_t i = 0; i < newPaths.size(); ++i) {
+        next->update(newPaths[i], values[i]);
+    }
+    if (previous && (previous != next)) {
+        previous->lampsOff(next);
+    }
+
+    const auto usec = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    std::cerr << "Switched to profile " << next->name() << " in " << usec << " usec ("
+              << unsubscribed << " unsubscribed, " << (lines.size() - unsubscribed) << " subscribed, "
+              << values.size() << " values)" << std::endl;
+    return true;
+}
+
+void checkConnection();
 
-const char* WEU_OUTPUT_PREFIX = "/instrumentation/weu/outputs/";
-const int WEU_OUTPUT_PREFIX_LEN = 29;
-const char* WEU_LAMP_SUFFIX = "-lamp=";
-const int WEU_LAMP_SUFFIX_LEN = 6;
+void requestProfileFor(const std::string& aircraft)
+{
+    const AircraftProfile* next = profileFor(aircraft);
+    if (next == global_profile) {
+        return;
+    }
+
+    // not from inside the socket's read handler: the switch reads replies
+    global_loop->addTimer(std::chrono::microseconds(0), [next](uint64_t) {
+        if (global_fgSocket->isConnected() && (next != global_profile) && !switchProfile(next, global_profile)) {
+            global_fgSocket->close();
+        }
+        checkConnection();
+    }, false /* one-shot */);
+}
 
 void pollHandler(const std::string& message)
 {
-    bool gearUpdateRequired  = false;
-
-    // Telnet code doesn't send index for [0]
-    if (message.find("/gear/gear/position-norm=") == 0) {
-        gearPositionNorm[0] = std::stod(message.substr(25));
-        gearUpdateRequired = true;
-    } else if (message.find("/gear/gear[0]/position-norm=") == 0) {
-        gearPositionNorm[0] = std::stod(message.substr(28));
-        gearUpdateRequired = true;
-    } else if (message.find("/gear/gear[1]/position-norm=") == 0) {
-        gearPositionNorm[1] = std::stod(message.substr(28));
-        gearUpdateRequired = true;
-    } else if (message.find("/gear/gear[2]/position-norm=") == 0) {
-        gearPositionNorm[2] = std::stod(message.substr(28));
-        gearUpdateRequired = true;
-    } else if (message.find("/surface-positions/flap-pos-norm=") == 0) {
-        flapPositionNorm =  std::stod(message.substr(33));
-        updateFlapPosition();
-    } else if (message.find("/instrumentation/weu/outputs/") == 0) {
-        const auto lampSuffix = message.find(WEU_LAMP_SUFFIX);
-        const std::string lampName = message.substr(WEU_OUTPUT_PREFIX_LEN,
-            lampSuffix - WEU_OUTPUT_PREFIX_LEN);
-
-        auto it = std::find(lampNames.begin(), lampNames.end(), lampName);
-        if (it == lampNames.end()) {
-            std::cerr << "weird lamp name:" << lampName << std::endl;
-            std::cerr << "full message was:" << message << std::endl;
-        } else {
-            try {
-                const int lampIndex = std::distance(lampNames.begin(), it);
-                const auto v = message.substr(lampSuffix + WEU_LAMP_SUFFIX_LEN);
-                const bool b = (v == "true");
-                setWEULampBit(lampIndex, b);
-            } catch (std::exception& e) {
-                std::cerr << "exception processing value data:" << message.substr(lampSuffix + WEU_LAMP_SUFFIX_LEN) << std::endl;
-                std::cerr << "full message was:" << message << std::endl;
-            }
+    const size_t equals = message.find('=');
+    if ((message.compare(0, 1, "/") == 0) && (equals != std::string::npos)) {
+        const std::string path = message.substr(0, equals);
+        const std::string value = message.substr(equals + 1);
+
+        if (path == "/sim/aircraft") {
+            requestProfileFor(value);
+            return;
         }
-    } else {
-        if (message.find("subscribe") == 0) {
-            // subscription confirmation, fine
-        } else if (message == "/") {
-            // this is the response to the 'pwd' query we use to keep
-            // the socket alive.
-        } else {
-            std::cerr << "unhandled message:" << message << std::endl;
+
+        // a gauge or dimming property may also drive profile lamps
+        bool handled = updateGauges(path, value);
+        if (!global_dimmingProperty.empty() &&
+            (AircraftProfile::normalizePath(path) == AircraftProfile::normalizePath(global_dimmingProperty)))
+        {
+            panelBrightnessNorm = atof(value.c_str());
+            ++panelDimmingUpdates;
+            handled = true;
+        }
+
+        if (global_profile && global_profile->update(path, value)) {
+            handled = true;
+        }
+        if (handled) {
+            return;
         }
     }
 
-    if (gearUpdateRequired) {
-        updateGearLampState();
+    if ((message.find("subscribe") == 0) || (message.find("unsubscribe") == 0)) {
+        // subscription confirmation, fine
+    } else if (message == "/") {
+        // this is the response to the 'pwd' query we use to keep
+        // the socket alive.
+    } else {
+        std::cerr << "unhandled message:" << message << std::endl;
     }
 }
 
@@ -289,273 +404,464 @@ void setHDMIEnabled(bool b)
     }
 } 
 
-void idleForTime(int timeSec)
+void connectToFlightGear();
+
+void scheduleReconnect(int delaySec)
 {
-    time_t endTime = time(nullptr) + timeSec;
-    setSpecialLEDState(SpecialLEDState::ConnectBackoff);
-    while (time(nullptr) < endTime) {
-        ::usleep(500 * 1000);
-        setSpecialLEDState(SpecialLEDState::ConnectBackoff2);
-        ::usleep(500 * 1000);
-        setSpecialLEDState(SpecialLEDState::ConnectBackoff);
+    global_loop->addTimer(std::chrono::seconds(delaySec), [](uint64_t) {
+        connectToFlightGear();
+    }, false /* one-shot */);
+}
+
+// the socket closes itself on any read or write failure, including writes
+// from input callbacks, so this is checked after each batch of work
+void checkConnection()
+{
+    if ((registeredSocketFd < 0) || global_fgSocket->isConnected()) {
+        return;
     }
+
+    global_loop->removeFd(registeredSocketFd);
+    registeredSocketFd = -1;
+    global_fgSocket->close();
+    scheduleReconnect(0);
 }
 
-void defineGearSixpackInputs(GPIOPoller& i)
+void connectToFlightGear()
 {
-    i.addBinding(InputBinding{Gear_I2C_Address, Gear_Sixpack_Switch_Port, 3, [](bool b) {
-            std::cerr << "Fire warn push" << std::endl;
-            global_fgSocket->write("run weu-fire-button");
-    }, Trigger::High});
+    setSpecialLEDState(SpecialLEDState::Connecting);
+    if (!global_fgSocket->connect(fgfsHost, fgfsPort)) {
+        setHDMIEnabled(false); // save backlight when not connected
+        setSpecialLEDState(SpecialLEDState::ConnectBackoff);
+        scheduleReconnect(reconnectBackoff);
+        reconnectBackoff = std::min(reconnectBackoff * 2, 30);
+        return;
+    }
 
-    i.addBinding(InputBinding{Gear_I2C_Address, Gear_Sixpack_Switch_Port, 4, [](bool b) {
-            std::cerr << "Master Caution push" << std::endl;
-            global_fgSocket->write("run weu-caution-button");
-    }, Trigger::High});
+    // reset back-off after succesful connect
+    reconnectBackoff = defaultReconnectBackoff;
+    setSpecialLEDState(SpecialLEDState::DidConnect);
 
-// master caution recall push
-    i.addBinding(InputBinding{Gear_I2C_Address, Gear_Sixpack_Switch_Port, 5, [](bool b) {
-            std::cerr << "recall push" << std::endl;
-            global_fgSocket->write("run weu-recall-button");
-    }, Trigger::High});
+    std::string aircraft;
+    std::vector<std::string> subscriptions = {"subscribe /sim/aircraft"};
+    bool ok = global_fgSocket->syncGetString("/sim/aircraft", aircraft);
 
-// release binding for master-caution recall
-    i.addBinding(InputBinding{Gear_I2C_Address, Gear_Sixpack_Switch_Port, 5, [](bool b) {
-            std::cerr << "recall release" << std::endl;
-            global_fgSocket->write("run weu-recall-button-off");
-    }, Trigger::Low});
+    for (const auto& g : global_gaugesByPath) {
+        const std::string& path = g.second.path;
+        std::string value;
+        ok = ok && global_fgSocket->syncGetString(path, value);
+        if (!value.empty()) {
+            updateGauges(path, value);
+        }
+        subscriptions.push_back("subscribe " + path);
+    }
 
-// gear port
-    // 0 and 1 are outputs
-    i.addBinding(InputBinding{Gear_I2C_Address, Gear_Sixpack_Switch_Port, 1, [](bool b) {
-        std::cerr << "gear down" << std::endl;
-        global_fgSocket->set("/controls/gear/gear-down", "1");
-    }, Trigger::High});
+    if (ok && !global_dimmingProperty.empty()) {
+        std::string brightness;
+        ok = global_fgSocket->syncGetString(global_dimmingProperty, brightness);
+        if (!brightness.empty()) {
+            panelBrightnessNorm = atof(brightness.c_str());
+        }
+        subscriptions.push_back("subscribe " + global_dimmingProperty);
+    }
 
-    i.addBinding(InputBinding{Gear_I2C_Address, Gear_Sixpack_Switch_Port, 0, [](bool b) {
-        std::cerr << "gear up" << std::endl;
-        global_fgSocket->set("/controls/gear/gear-down", "0");
-    }, Trigger::High});
+    ok = ok && global_fgSocket->writeLines(subscriptions)
+        && switchProfile(profileFor(aircraft), nullptr);
+    if (!ok) {
+        std::cerr << "failed to get initial state, will re-try" << std::endl;
+        global_fgSocket->close();
+        scheduleReconnect(0);
+        return;
+    }
 
-    i.addBinding(InputBinding{Gear_I2C_Address, Gear_Sixpack_Switch_Port, 2, [](bool b) {
-        std::cerr << "gear off" << std::endl;
-           // global_fgSocket->set("/controls/gear/gear-down", "0");
-    }, Trigger::High});
+    setSpecialLEDState(SpecialLEDState::DidConnect);
+    updatePanelDimming();
+    setHDMIEnabled(true); // enable HDMI output after successful connection
+
+    registeredSocketFd = global_fgSocket->fd();
+    global_loop->addFd(registeredSocketFd, EventLoop::Readable, [](unsigned int events) {
+        if (events & EventLoop::Error) {
+            std::cerr << "socket error during poll" << std::endl;
+            global_fgSocket->close();
+        } else {
+            global_fgSocket->readAvailable(pollHandler);
+        }
+        checkConnection();
+    });
 }
 
-void defineMIPInputs(GPIOPoller& mipA, GPIOPoller& mipB)
+constexpr PinRef gearSwitch(uint8_t bit)
 {
-    mipA.addBinding(InputBinding{MIP1_I2C_Address, MIP1_N1_Port, 6, [](bool b) {
-        std::cerr << "N1 1" << std::endl;
-    }, Trigger::High});
-
-    mipA.addBinding(InputBinding{MIP1_I2C_Address, MIP1_N1_Port, 7, [](bool b) {
-        std::cerr << "N1 2" << std::endl;
-    }, Trigger::High});
+    return PinRef{Gear_I2C_Address, Gear_Sixpack_Switch_Port, bit};
+}
 
-    mipA.addBinding(InputBinding{MIP1_I2C_Address, MIP1_N1_Port, 4, [](bool b) {
-        std::cerr << "N1 Both" << std::endl;
-    }, Trigger::High});
+constexpr PinRef n1Switch(uint8_t bit)
+{
+    return PinRef{MIP1_I2C_Address, MIP1_N1_Port, bit};
+}
 
-    mipA.addBinding(InputBinding{MIP1_I2C_Address, MIP1_N1_Port, 5, [](bool b) {
-        std::cerr << "N1 auto" << std::endl;
-    }, Trigger::High});
+constexpr PinRef speedSwitch(uint8_t bit)
+{
+    return PinRef{MIP1_I2C_Address, MIP1_Speeds_Port, bit};
+}
 
-    mipA.addBinding(InputBinding{MIP1_I2C_Address, MIP1_N1_Port, 3, [](bool b) {
-        // N1 encoder
-        std::cerr << "N1 encoder A " << b << std::endl;
-    }});
+constexpr PinRef autobrakeSwitch(uint8_t bit)
+{
+    return PinRef{MIP2_I2C_Address, MIP2_Autobrake_Port, bit};
+}
 
-    mipA.addBinding(InputBinding{MIP1_I2C_Address, MIP1_N1_Port, 2, [](bool b) {
-        // N1 encoder
-        std::cerr << "N1 encoder B " << b << std::endl;
-    }});
+constexpr PinRef afdsSwitch(uint8_t bit)
+{
+    return PinRef{MIP2_I2C_Address, MIP2_AFDS_Switch_Port, bit};
+}
 
-    mipA.addBinding(InputBinding{MIP1_I2C_Address, MIP1_N1_Port, 1, [](bool b) {
-        std::cerr << "Fuel-flow used" << std::endl;
-    }, Trigger::High});
+constexpr PinBinding PanelInputs[] = {
+// six-pack
+    writeOn(gearSwitch(3), Trigger::High, "Fire warn push", "run weu-fire-button"),
+    writeOn(gearSwitch(4), Trigger::High, "Master Caution push", "run weu-caution-button"),
+    writeOn(gearSwitch(5), Trigger::High, "recall push", "run weu-recall-button"),
+    writeOn(gearSwitch(5), Trigger::Low, "recall release", "run weu-recall-button-off"),
+
+// gear lever; port 0 holds the lamps
+    setOn(gearSwitch(1), Trigger::High, "gear down", "/controls/gear/gear-down", "1"),
+    setOn(gearSwitch(0), Trigger::High, "gear up", "/controls/gear/gear-down", "0"),
+    logOn(gearSwitch(2), Trigger::High, "gear off"),
+
+// first MIP chip; the encoders are in encoderPins
+    logOn(n1Switch(6), Trigger::High, "N1 1"),
+    logOn(n1Switch(7), Trigger::High, "N1 2"),
+    logOn(n1Switch(4), Trigger::High, "N1 Both"),
+    logOn(n1Switch(5), Trigger::High, "N1 auto"),
+    logOn(n1Switch(1), Trigger::High, "Fuel-flow used"),
+    logOn(n1Switch(0), Trigger::High, "Fuel-flow reset"),
+
+    logOn(speedSwitch(0), Trigger::High, "Speed AUTO"),
+    logOn(speedSwitch(1), Trigger::High, "Speed V1"),
+    logOn(speedSwitch(2), Trigger::High, "Speed Vr"),
+    logOn(speedSwitch(3), Trigger::High, "Speed WT"),
+    logOn(speedSwitch(4), Trigger::High, "SPD Less-than"),
+    logOn(speedSwitch(5), Trigger::High, "SPD set"),
+
+// second MIP chip
+    logOn(autobrakeSwitch(6), Trigger::High, "MFD ENG"),
+    logOn(autobrakeSwitch(7), Trigger::High, "MFD SYS"),
+
+    setOn(autobrakeSwitch(1), Trigger::High, "AB off", "/controls/brakes/autobrake", "0"),
+    setOn(autobrakeSwitch(0), Trigger::High, "AB RTO", "/controls/brakes/autobrake", "-1"),
+    setOn(autobrakeSwitch(2), Trigger::High, "AB 1", "/controls/brakes/autobrake", "1"),
+    setOn(autobrakeSwitch(3), Trigger::High, "AB 2", "/controls/brakes/autobrake", "2"),
+    setOn(autobrakeSwitch(4), Trigger::High, "AB 3", "/controls/brakes/autobrake", "3"),
+    setOn(autobrakeSwitch(5), Trigger::High, "AB MAX", "/controls/brakes/autobrake", "4"),
 
-    mipA.addBinding(InputBinding{MIP1_I2C_Address, MIP1_N1_Port, 0, [](bool b) {
-        std::cerr << "Fuel-flow reset" << std::endl;
-    }, Trigger::High});
+// AFDS switches
+    logOn(afdsSwitch(0), Trigger::High, "A/T RESET"),
+    logOn(afdsSwitch(1), Trigger::High, "A/P RESET"),
+    logOn(afdsSwitch(2), Trigger::High, "FMC RESET"),
+    logOn(afdsSwitch(3), Trigger::High, "AFDS TEST1"),
+    logOn(afdsSwitch(4), Trigger::High, "AFDS TEST2"),
+};
 
-// second port
-    mipA.addBinding(InputBinding{MIP1_I2C_Address, MIP1_Speeds_Port, 0, [](bool b) {
-        std::cerr << "Speed AUTO" << std::endl;
-    }, Trigger::High});
+static_assert(validPins(PanelInputs), "binding on a port other than 0-1 or a bit other than 0-7");
+static_assert(knownChips(PanelChips, PanelInputs), "binding on a chip missing from PanelChips");
+static_assert(noDuplicateBindings(PanelInputs), "two bindings for the same pin and edge");
+static_assert(unbound(PanelInputs, gearLampPins) && unbound(PanelInputs, sixpackLampPins) &&
+              unbound(PanelInputs, fireCautionLampPins) && unbound(PanelInputs, afdsLampPins) &&
+              unbound(PanelInputs, autobrakeLampPins), "pin bound as both an input and a lamp output");
+static_assert(unbound(PanelInputs, encoderPins), "encoder pin also has a switch binding");
+static_assert(disjoint(encoderPins, gearLampPins) && disjoint(encoderPins, sixpackLampPins) &&
+              disjoint(encoderPins, fireCautionLampPins) && disjoint(encoderPins, afdsLampPins) &&
+              disjoint(encoderPins, autobrakeLampPins), "encoder pin is also a lamp output");
+static_assert(validPins(encoderPins) && noDuplicatePins(encoderPins), "bad encoder pins");
+
+void dispatchPanelEvent(const InputEvent& ev)
+{
+    const BindingSet& bindings = global_profile->bindings();
+    const BindingSet::Entry* b = bindings.find(ev);
+    if (!b) {
+        return;
+    }
 
-    mipA.addBinding(InputBinding{MIP1_I2C_Address, MIP1_Speeds_Port, 1, [](bool b) {
-        std::cerr << "Speed V1" << std::endl;
-    }, Trigger::High});
+    std::cerr << bindings.label(*b) << std::endl;
+    if (b->commandLength > 0) {
+        global_fgSocket->writeRaw(bindings.command(*b), b->commandLength);
+    }
+}
 
-    mipA.addBinding(InputBinding{MIP1_I2C_Address, MIP1_Speeds_Port, 2, [](bool b) {
-        std::cerr << "Speed Vr" << std::endl;
-    }, Trigger::High});
+// call after defineOutputs()
+PanelLayout panelLayout()
+{
+    PanelLayout layout;
+    layout.chips.assign(std::begin(PanelChips), std::end(PanelChips));
 
-    mipA.addBinding(InputBinding{MIP1_I2C_Address, MIP1_Speeds_Port, 3, [](bool b) {
-        std::cerr << "Speed WT" << std::endl;
-    }, Trigger::High});
+    auto addLamps = [&layout](const PinRef* pins, const LampRef* lamps, size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            layout.reserved.push_back(pins[i]);
+            layout.lamps.push_back(PanelLayout::Lamp{pins[i].address, pins[i].port * 8u + pins[i].bit, lamps[i]});
+        }
+    };
+    addLamps(gearLampPins, gearLamps, 6);
+    addLamps(sixpackLampPins, sixpackLamps, 6);
+    addLamps(fireCautionLampPins, fireCautionLamps, 2);
+    addLamps(afdsLampPins, afdsLamps, 5);
+    addLamps(autobrakeLampPins, autobrakeLamps, 4);
+
+    if (global_ledLamps) {
+        for (unsigned int c = 0; c < 16; ++c) {
+            layout.lamps.push_back(PanelLayout::Lamp{Lamp_Driver_I2C_Address, c, global_ledLamps->lamp(c)});
+        }
+    }
 
+    layout.reserved.insert(layout.reserved.end(), std::begin(encoderPins), std::end(encoderPins));
+    return layout;
+}
 
-    mipA.addBinding(InputBinding{MIP1_I2C_Address, MIP1_Speeds_Port, 4, [](bool b) {
-                std::cerr << "SPD Less-than" << std::endl;
-        }, Trigger::High});
+// PanelInputs, with the gear and WEU lamp logic
+AircraftProfile* builtin738Profile(const PanelLayout& layout)
+{
+    BindingSet bindings(layout.chips, layout.reserved);
+    std::string error;
+    if (!bindings.addTable(PanelInputs, error)) {
+        std::cerr << "built-in bindings: " << error << std::endl;
+        exit(EXIT_FAILURE);
+    }
 
-    mipA.addBinding(InputBinding{MIP1_I2C_Address, MIP1_Speeds_Port, 5, [](bool b) {
-                std::cerr << "SPD set" << std::endl;
-        }, Trigger::High});
+    AircraftProfile* profile = new AircraftProfile("738", std::move(bindings));
+    profile->addAircraft("737-800");
 
-    mipA.addBinding(InputBinding{MIP1_I2C_Address, MIP1_Speeds_Port, 6, [](bool b) {
-        std::cerr << "Speed encoder A " << b << std::endl;
-    }});
+    for (int i=0; i<3; ++i) {
+        LampRule unsafe;
+        unsafe.property = "/gear/gear[" + to_string(i) + "]/position-norm";
+        unsafe.lamp = gearLamps[i * 2];
+        unsafe.numeric = true;
+        unsafe.min = gearUpAndLockedThreshold;
+        unsafe.minInclusive = false;
+        unsafe.max = gearDownAndLockedThreshold;
+        profile->addLamp(unsafe);
+
+        LampRule downAndLocked = unsafe;
+        downAndLocked.lamp = gearLamps[i * 2 + 1];
+        downAndLocked.min = gearDownAndLockedThreshold;
+        downAndLocked.minInclusive = true;
+        downAndLocked.max = HUGE_VAL;
+        profile->addLamp(downAndLocked);
+    }
 
-    mipA.addBinding(InputBinding{MIP1_I2C_Address, MIP1_Speeds_Port, 7, [](bool b) {
-        std::cerr << "Speed encoder B " << b << std::endl;
-    }});
+    for (size_t i=0; i<lampNames.size(); ++i) {
+        LampRule weu;
+        weu.property = "/instrumentation/weu/outputs/" + lampNames.at(i) + "-lamp";
+        weu.lamp = (i < 2) ? fireCautionLamps[i] : sixpackLamps[i - 2];
+        profile->addLamp(weu);
+    }
 
-// second MIP  chip
+    return profile;
+}
 
-    mipB.addBinding(InputBinding{MIP2_I2C_Address, MIP2_Autobrake_Port, 6, [](bool b) {
-        std::cerr << "MFD ENG" << std::endl;
-    }, Trigger::High});
+// the --profile files if given, otherwise the built-in 738 profile
+void loadProfiles(const PanelLayout& layout)
+{
+    const auto start = std::chrono::steady_clock::now();
+    if (global_profileFiles.empty()) {
+        global_profiles.push_back(builtin738Profile(layout));
+    }
 
-    mipB.addBinding(InputBinding{MIP2_I2C_Address, MIP2_Autobrake_Port, 7, [](bool b) {
-        std::cerr << "MFD SYS" << std::endl;
-    }, Trigger::High});
+    for (const auto& path : global_profileFiles) {
+        std::string error;
+        AircraftProfile* profile = AircraftProfile::loadJSON(path, layout, error);
+        if (!profile) {
+            std::cerr << "failed to load profile: " << error << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        global_profiles.push_back(profile);
+    }
 
-    // MIP autobrake settings
-    mipB.addBinding(InputBinding{MIP2_I2C_Address, MIP2_Autobrake_Port, 1, [](bool b) {
-            std::cerr << "AB off" << std::endl;
-            global_fgSocket->set("/controls/brakes/autobrake", "0");
-    }, Trigger::High});
+    const auto usec = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    std::cerr << "Loaded " << global_profiles.size() << " aircraft profile(s) in " << usec << " usec:";
+    for (const AircraftProfile* p : global_profiles) {
+        std::cerr << " " << p->name() << " (" << p->bindings().size() << " bindings, "
+                  << p->subscriptions().size() << " properties)";
+    }
+    std::cerr << std::endl;
+}
 
-    mipB.addBinding(InputBinding{MIP2_I2C_Address, MIP2_Autobrake_Port, 0, [](bool b) {
-            std::cerr << "AB RTO" << std::endl;
-            global_fgSocket->set("/controls/brakes/autobrake", "-1");
-    }, Trigger::High});
+// the --calibration file if given, otherwise the built-in curves
+void loadCalibration()
+{
+    std::string error;
+    if (!global_calibrationFile.empty() && !global_calibration.loadJSON(global_calibrationFile, error)) {
+        std::cerr << "failed to load calibration: " << error << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
 
-    mipB.addBinding(InputBinding{MIP2_I2C_Address, MIP2_Autobrake_Port, 2, [](bool b) {
-            std::cerr << "AB 1" << std::endl;
-            global_fgSocket->set("/controls/brakes/autobrake", "1");
-    }, Trigger::High});
+GaugeProperty& gaugeProperty(const std::string& path)
+{
+    GaugeProperty& result = global_gaugesByPath[AircraftProfile::normalizePath(path)];
+    result.path = path;
+    return result;
+}
 
-    mipB.addBinding(InputBinding{MIP2_I2C_Address, MIP2_Autobrake_Port, 3, [](bool b) {
-            std::cerr << "AB 2" << std::endl;
-            global_fgSocket->set("/controls/brakes/autobrake", "2");
-    }, Trigger::High});
+// a gauge for each calibrated channel with a property; all of them are
+// committed to the PCA9685 together, once per gauge tick
+void addGauges()
+{
+    for (const GaugeCurve& curve : global_calibration.curves()) {
+        if (curve.property().empty()) {
+            continue;
+        }
 
-    mipB.addBinding(InputBinding{MIP2_I2C_Address, MIP2_Autobrake_Port, 4, [](bool b) {
-            std::cerr << "AB 3" << std::endl;
-            global_fgSocket->set("/controls/brakes/autobrake", "3");
-    }, Trigger::High});
+        const unsigned int gauge = global_gauges->addGauge(curve.channel(), curve.countFor(curve.min()), curve.slew());
+        gaugeProperty(curve.property()).servos.push_back(PropertyGauge{&curve, gauge});
+        std::cerr << "Gauge " << curve.name() << " on channel " << int(curve.channel())
+                  << " follows " << curve.property() << std::endl;
+    }
+}
 
-    mipB.addBinding(InputBinding{MIP2_I2C_Address, MIP2_Autobrake_Port, 5, [](bool b) {
-                std::cerr << "AB MAX" << std::endl;
-                global_fgSocket->set("/controls/brakes/autobrake", "4");
-        }, Trigger::High});
+// the stepper gauges share a PCA9685 of their own, which runs at a coil
+// PWM frequency far above what servos accept
+void addSteppers()
+{
+    if (global_calibration.steppers().empty()) {
+        return;
+    }
 
+    global_stepperChip = new Adafruit_PWMServoDriver(Stepper_Driver_I2C_Address, Stepper_PWM_Frequency, Servo_Driver_I2C_Bus);
+    global_stepperChip->begin();
+    global_steppers = new StepperDriver(*global_stepperChip);
+    for (const StepperGaugeConfig& config : global_calibration.steppers()) {
+        const unsigned int stepper = global_steppers->addStepper(config);
+        gaugeProperty(config.property).steppers.push_back(stepper);
+        std::cerr << "Stepper " << config.name << " on channels " << int(config.channel) << "-"
+                  << int(config.channel + 3) << " follows " << config.property << std::endl;
+    }
+}
 
+void startTrace(int bus)
+{
+    if (!global_traceFile.empty() && global_tracedBuses.insert(bus).second) {
+        I2CBus::get(bus).startTrace();
+    }
 }
 
-void defineAFDSInputs(GPIOPoller& i)
+// one trace file per bus: FILE itself with a single bus, FILE.<bus> with
+// several
+void writeTraces()
 {
-// AFDS switches
-    i.addBinding(InputBinding{MIP2_I2C_Address, MIP2_AFDS_Switch_Port, 0, [](bool b) {
-            std::cerr << "A/T RESET" << std::endl;
-        }, Trigger::High});
+    for (int bus : global_tracedBuses) {
+        const auto records = I2CBus::get(bus).tracer()->snapshot();
+        std::cerr << "I2C trace of i2c-" << bus << ":" << std::endl;
+        I2CTracer::summarize(records, std::cerr);
+
+        const std::string path = (global_tracedBuses.size() == 1) ? global_traceFile
+            : global_traceFile + "." + std::to_string(bus);
+        if (!I2CTracer::write(path, records)) {
+            std::cerr << "failed to write I2C trace to " << path << std::endl;
+        }
+    }
+}
 
-    i.addBinding(InputBinding{MIP2_I2C_Address, MIP2_AFDS_Switch_Port, 1, [](bool b) {
-            std::cerr << "A/P RESET" << std::endl;
-        }, Trigger::High});
+void defineDebounce(GPIOBank& bank)
+{
+    bank.setDefaultSettleTime(global_debounce);
+    if (global_debounce.count() == 0) {
+        return;
+    }
 
-    i.addBinding(InputBinding{MIP2_I2C_Address, MIP2_AFDS_Switch_Port, 2, [](bool b) {
-            std::cerr << "FMC RESET" << std::endl;
-        }, Trigger::High});
+    // the gear lever and autobrake rotary have noisy mechanical contacts
+    const auto slowContacts = std::max<std::chrono::microseconds>(global_debounce, std::chrono::milliseconds(10));
+    for (uint8_t bit = 0; bit < 3; ++bit) {
+        bank.setSettleTime(Gear_I2C_Address, Gear_Sixpack_Switch_Port, bit, slowContacts);
+    }
+    for (uint8_t bit = 0; bit < 6; ++bit) {
+        bank.setSettleTime(MIP2_I2C_Address, MIP2_Autobrake_Port, bit, slowContacts);
+    }
 
-    i.addBinding(InputBinding{MIP2_I2C_Address, MIP2_AFDS_Switch_Port, 3, [](bool b) {
-            std::cerr << "AFDS TEST1" << std::endl;
-        }, Trigger::High});
+    // the encoder decoder needs every transition
+    for (const PinRef& p : encoderPins) {
+        bank.setSettleTime(p.address, p.port, p.bit, std::chrono::microseconds(0));
+    }
+}
 
-    i.addBinding(InputBinding{MIP2_I2C_Address, MIP2_AFDS_Switch_Port, 4, [](bool b) {
-            std::cerr << "AFDS TEST2" << std::endl;
-        }, Trigger::High});
+unsigned int addInput(GPIOBank& bank, const PinRef& p)
+{
+    return bank.addInput(p.address, p.port, p.bit);
 }
 
-void defineGearOutputs(GPIOPoller& gpio)
+LampRef addLamp(GPIOBank& bank, const PinRef& p)
 {
-    for (uint8_t i=0; i<6; i++) {
-        //gearLamps[i] = new LEDOutput(global_ledDriver, i);
-        gearLamps[i] = OutputBindingRef{new OutputBinding{Gear_Lamp_Port, 0}};
-        gpio.addOutput(gearLamps[i]);
-    }
+    return global_gpioLamps->addLamp(bank.addOutput(p.address, p.port, p.bit));
 }
 
-void defineSixpackOutputs(GPIOPoller& gpio)
+void defineMIPEncoders(GPIOBank& bank)
 {
-    fireCautionLamps[0] = OutputBindingRef{new OutputBinding{Sixpack_Lamp_Port, 6}};
-    fireCautionLamps[1] = OutputBindingRef{new OutputBinding{Sixpack_Lamp_Port, 7}};
-    gpio.addOutput(fireCautionLamps[0]);
-    gpio.addOutput(fireCautionLamps[1]);
+    QuadratureEncoder* n1 = new QuadratureEncoder(addInput(bank, encoderPins[0]), addInput(bank, encoderPins[1]));
+    global_encoders.push_back(EncoderBinding{"/instrumentation/mip/n1-set-value", 0.1, MIP1_I2C_Bus, n1});
 
-    for (uint8_t i=0; i<6; i++) {
-        //sixpackLamps[i] = new LEDOutput(global_ledDriver, i + 8);
-        sixpackLamps[i] = OutputBindingRef{new OutputBinding{Sixpack_Lamp_Port, i}};
-        gpio.addOutput(sixpackLamps[i]);
-    }
+    QuadratureEncoder* speed = new QuadratureEncoder(addInput(bank, encoderPins[2]), addInput(bank, encoderPins[3]));
+    global_encoders.push_back(EncoderBinding{"/instrumentation/mip/speed-ref-value", 1.0, MIP1_I2C_Bus, speed});
 }
 
-void defineAFDSOutputs(GPIOPoller& gpio)
+// one adjustment per encoder per tick, however many detents it moved
+void updateEncoders()
 {
-    for (uint8_t i=0; i<5; i++) {
-        const uint8_t pin = i + 3;
-        afdsLamps[i] = OutputBindingRef{new OutputBinding{AFDS_MIP_Lamp_Port, pin}};
-        gpio.addOutput(afdsLamps[i]);
+    for (auto& e : global_encoders) {
+        const int32_t detents = e.encoder->takeDelta();
+        if (detents == 0) {
+            continue;
+        }
+
+        std::ostringstream cmd;
+        cmd << "run property-adjust property=" << e.property << " step=" << (detents * e.step);
+        if (global_testMode) {
+            std::cerr << cmd.str() << std::endl;
+        } else if (global_fgSocket->isConnected()) {
+            global_fgSocket->write(cmd.str());
+        }
     }
 }
 
-void defineMIPOutputs(GPIOPoller& gpio, GPIOPoller& mip2GPIO)
+void defineOutputs(GPIOBank& bank)
 {
-    for (uint8_t i=0; i<3; i++) {
-        autobrakeLamps[i] = OutputBindingRef{new OutputBinding{AFDS_MIP_Lamp_Port, i}};
-        gpio.addOutput(autobrakeLamps[i]);
+    for (uint8_t i=0; i<6; i++) {
+        gearLamps[i] = addLamp(bank, gearLampPins[i]);
+        sixpackLamps[i] = addLamp(bank, sixpackLampPins[i]);
+    }
+
+    for (uint8_t i=0; i<2; i++) {
+        fireCautionLamps[i] = addLamp(bank, fireCautionLampPins[i]);
     }
 
-// odd pin out
-    autobrakeLamps[3] = OutputBindingRef{new OutputBinding{MIP2_AFDS_Switch_Port, 5}};
-    mip2GPIO.addOutput(autobrakeLamps[3]);
+    for (uint8_t i=0; i<5; i++) {
+        afdsLamps[i] = addLamp(bank, afdsLampPins[i]);
+    }
+
+    for (uint8_t i=0; i<4; i++) {
+        autobrakeLamps[i] = addLamp(bank, autobrakeLampPins[i]);
+    }
 }
 
 void updateTestMode()
 {
-#if 0
-LEDOutput* gearLamps[6];
-LEDOutput* sixpackLamps[6];
-OutputBindingRef fireCautionLamps[2];
-OutputBindingRef afdsLamps[3];
-OutputBindingRef autobrakeLamps[4];
-
-#endif
     static int ledLampIt = 5; // so we start at zero
-    gearLamps[ledLampIt]->setState(false);
-    sixpackLamps[ledLampIt]->setState(false);
+    gearLamps[ledLampIt].set(false);
+    sixpackLamps[ledLampIt].set(false);
     ledLampIt = (ledLampIt + 1) % 6;
-    gearLamps[ledLampIt]->setState(true);
-    sixpackLamps[ledLampIt]->setState(true);
+    gearLamps[ledLampIt].set(true);
+    sixpackLamps[ledLampIt].set(true);
 
     static bool fireCautionToggle = false;
     fireCautionToggle = !fireCautionToggle;
-    fireCautionLamps[0]->setState(fireCautionToggle);
-    fireCautionLamps[1]->setState(!fireCautionToggle);
+    fireCautionLamps[0].set(fireCautionToggle);
+    fireCautionLamps[1].set(!fireCautionToggle);
 
     static int mipLampsIt = 3; // so we start at zero
-    autobrakeLamps[mipLampsIt]->setState(false);
+    autobrakeLamps[mipLampsIt].set(false);
     mipLampsIt = (mipLampsIt + 1) % 4;
-    autobrakeLamps[mipLampsIt]->setState(true);
+    autobrakeLamps[mipLampsIt].set(true);
 
     static int afdsLampsIt = 2; // so we start at zero
-    afdsLamps[afdsLampsIt]->setState(false);
+    afdsLamps[afdsLampsIt].set(false);
     afdsLampsIt = (afdsLampsIt + 1) % 5;
-    afdsLamps[afdsLampsIt]->setState(true);
+    afdsLamps[afdsLampsIt].set(true);
 }
 
 const char* argp_program_version = "simGPIO 0.2";
@@ -564,6 +870,20 @@ static struct argp_option options[] = {
   {"host",  'h', "HOSTNAME",      0,  "Host to connect to" },
   {"test",   't', 0,      0,  "Run in test mode - don't connect to FGFS" },
   {"port",   'p', "PORT",     0,  "Use PORT as the Websocket port" },
+  {"scan-rate", 'r', "HZ",    0,  "Scan GPIO inputs at HZ (default 500)" },
+  {"idle-rate", 'R', "HZ",    0,  "Drop to scanning at HZ while the inputs are quiet (default 100, 0 to always use the scan rate)" },
+  {"idle-after", 'A', "MSEC",  0,  "Inputs are quiet after MSEC without a change (default 2000)" },
+  {"stats",  's', 0,      0,  "Periodically print GPIO scan timing statistics" },
+  {"interrupt-gpio", 'i', "PIN[:BUS]", 0, "Scan immediately when Pi GPIO PIN (wired to the INT lines of the expanders on I2C BUS, default 1) rises; may be repeated" },
+  {"debounce", 'd', "MSEC",   0,  "Ignore input changes shorter than MSEC (default 4, 0 to disable)" },
+  {"virtual", 'V', "KHZ", OPTION_ARG_OPTIONAL, "Use simulated I2C chips on KHZ buses (default 100) instead of /dev/i2c-*" },
+  {"stimuli", 'S', "FILE", 0, "Replay input changes from FILE on the virtual bus" },
+  {"trace", 'T', "FILE", 0, "Trace every I2C transaction and write the trace to FILE on exit (FILE.<bus> for each bus when there are several)" },
+  {"profile", 'P', "FILE", 0, "Load an aircraft profile (bindings and lamps) from JSON FILE instead of the built-in 738 one; may be repeated, the first is the fallback" },
+  {"dimming", 'D', "PROPERTY", 0, "Dim the lamp driver's outputs with the normalized PROPERTY, e.g. /controls/lighting/panel-norm" },
+  {"gauges", 'g', 0, 0, "Drive the servo gauges, and any stepper gauges, on their PCA9685s" },
+  {"calibration", 'C', "FILE", 0, "Load the servo gauge curves and stepper gauges from JSON FILE, as written by servoTest --calibrate" },
+  {"lamp-driver", 'L', 0, 0, "Drive lamps on the PCA9622 (profile lamps with \"address\": \"0x31\" and a \"channel\"), faded like incandescent bulbs" },
   { nullptr }
 };
 
@@ -580,6 +900,57 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state)
     case 't':
       global_testMode = true;
       break;
+    case 'r':
+      global_scanRateHz = std::stoi(arg);
+      break;
+    case 'R':
+      global_idleRateHz = std::stoi(arg);
+      break;
+    case 'A':
+      global_idleAfter = std::chrono::milliseconds(std::stoi(arg));
+      break;
+    case 's':
+      global_printStats = true;
+      break;
+    case 'i':
+    {
+      const std::string spec = arg;
+      const size_t colon = spec.find(':');
+      const int bus = (colon == std::string::npos) ? 1 : std::stoi(spec.substr(colon + 1));
+      global_interruptPins.emplace_back(std::stoi(spec.substr(0, colon)), bus);
+    }
+      break;
+    case 'd':
+      global_debounce = std::chrono::milliseconds(std::stoi(arg));
+      break;
+    case 'V':
+      global_virtualBusKHz = arg ? std::stoi(arg) : 100;
+      break;
+    case 'S':
+      global_stimuliFile = arg;
+      break;
+    case 'T':
+      global_traceFile = arg;
+      break;
+    case 'P':
+      global_profileFiles.push_back(arg);
+      break;
+
+    case 'D':
+      global_dimmingProperty = arg;
+      break;
+
+    case 'L':
+      global_useLampDriver = true;
+      break;
+
+    case 'g':
+      global_useGauges = true;
+      break;
+
+    case 'C':
+      global_calibrationFile = arg;
+      break;
 
     case ARGP_KEY_ARG:
       break;
@@ -595,95 +966,223 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state)
 
 static struct argp argp = { options, parse_opt, nullptr, nullptr };
 
+void interruptHandler(int)
+{
+    if (global_loop) {
+        global_loop->quit();
+    }
+}
+
+VirtualI2CAdapter& virtualBus(int number)
+{
+    VirtualI2CAdapter*& adapter = global_virtualBuses[number];
+    if (!adapter) {
+        adapter = &VirtualI2CAdapter::install(number, global_virtualBusKHz * 1000);
+    }
+    return *adapter;
+}
+
+void createVirtualBus()
+{
+    virtualBus(Gear_I2C_Bus).add<VirtualMCP23017>(Gear_I2C_Address);
+    virtualBus(AFDS_I2C_Bus).add<VirtualMCP23017>(AFDS_I2C_Address);
+    virtualBus(MIP1_I2C_Bus).add<VirtualMCP23017>(MIP1_I2C_Address);
+    virtualBus(MIP2_I2C_Bus).add<VirtualMCP23017>(MIP2_I2C_Address);
+    virtualBus(Lamp_Driver_I2C_Bus).add<VirtualPCA9622>(Lamp_Driver_I2C_Address);
+    virtualBus(Servo_Driver_I2C_Bus).add<VirtualPCA9685>(Servo_Driver_I2C_Address);
+    virtualBus(Servo_Driver_I2C_Bus).add<VirtualPCA9685>(Stepper_Driver_I2C_Address);
+
+    // stimuli name expander addresses, so they go to the bus carrying the
+    // panel switches
+    if (!global_stimuliFile.empty() && !virtualBus(Gear_I2C_Bus).loadStimuli(global_stimuliFile)) {
+        exit(EXIT_FAILURE);
+    }
+}
+
 int main(int argc, char* argv[])
 {
     argp_parse(&argp, argc, argv, 0, 0, nullptr);
 
-    // install signal handlers?
+#if !defined(LINUX_BUILD)
+    if (global_virtualBusKHz == 0) {
+        global_virtualBusKHz = 100; // no I2C hardware here
+    }
+#endif
+    if (global_virtualBusKHz > 0) {
+        createVirtualBus();
+    }
+
+    // before the output chips' begin(), so their setup is traced too; the
+    // expander buses follow once the bank knows them
+    startTrace(Lamp_Driver_I2C_Bus);
+    startTrace(Servo_Driver_I2C_Bus);
+
     signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, interruptHandler);
+    signal(SIGTERM, interruptHandler);
 
     global_fgSocket = new FGFSTelnetSocket;
-    // global_ledDriver = new LEDDriver();
-    // global_ledDriver->begin();
-
-    GPIOPoller gearSixpackInputs(Gear_I2C_Address);
-    GPIOPoller sixpackAFDSOutputs(AFDS_I2C_Address);
-    GPIOPoller mipA(MIP1_I2C_Address);
-    GPIOPoller mipB(MIP2_I2C_Address);
-
-    defineGearSixpackInputs(gearSixpackInputs);
-    defineMIPInputs(mipA, mipB);
-    defineAFDSInputs(mipB);
-
-    defineMIPOutputs(sixpackAFDSOutputs, mipB);
-    defineGearOutputs(gearSixpackInputs);
-    defineSixpackOutputs(sixpackAFDSOutputs);
-    defineAFDSOutputs(mipA);
-
-    gearSixpackInputs.open();
-    sixpackAFDSOutputs.open();
-    mipA.open();
-    mipB.open();
-
-    int reconnectBackoff = defaultReconnectBackoff;
-    time_t lastReadTime = time(nullptr);
-    time_t testModeLastTime;
-
-    while (true) {
-        if (!global_testMode && !global_fgSocket->isConnected()) {
-        //    std::cerr << "starting connection" << std::endl;
-            setSpecialLEDState(SpecialLEDState::Connecting);
-            if (!global_fgSocket->connect(fgfsHost, fgfsPort)) {
-                setHDMIEnabled(false); // save backlight when not connected
-                idleForTime(reconnectBackoff);
-                reconnectBackoff = std::min(reconnectBackoff * 2, 30);
-                continue;
-            }
+    if (global_useLampDriver || !global_dimmingProperty.empty()) {
+        global_ledDriver = new LEDDriver(Lamp_Driver_I2C_Address, Lamp_Driver_I2C_Bus);
+        global_ledDriver->begin();
+        global_lampFader = new LampFader(*global_ledDriver);
+        for (uint8_t c = 0; c < 16; ++c) {
+            global_ledDriver->setDimmed(c, !global_dimmingProperty.empty());
+            global_lampFader->setFaded(c, true);
+        }
+        global_ledLamps = new PCA9622LampSink(*global_ledDriver, global_lampFader);
+    }
 
-            // reset back-off after succesful connect
-            reconnectBackoff = defaultReconnectBackoff;
-            setSpecialLEDState(SpecialLEDState::DidConnect);
+    if (global_useGauges) {
+        loadCalibration();
+        global_servoDriver = new Adafruit_PWMServoDriver(Servo_Driver_I2C_Address, 60.0, Servo_Driver_I2C_Bus);
+        global_servoDriver->begin();
+        global_gauges = new GaugeDriver(*global_servoDriver);
+        addGauges();
+        addSteppers();
+    }
 
-            if (!getInitialState()) {
-                std::cerr << "failed to get initial state, will re-try" << std::endl;
-                global_fgSocket->close();
-                continue;
-            }
+    // the same order as PanelChips, which the BindingSets' InputWord bits
+    // assume
+    GPIOBank bank;
+    bank.addChip(Gear_I2C_Address, Gear_I2C_Bus);
+    bank.addChip(AFDS_I2C_Address, AFDS_I2C_Bus);
+    bank.addChip(MIP1_I2C_Address, MIP1_I2C_Bus);
+    bank.addChip(MIP2_I2C_Address, MIP2_I2C_Bus);
+    global_gpio = &bank;
+    for (int bus : bank.buses()) {
+        startTrace(bus);
+    }
 
-            setupSubscriptions();
-            setSpecialLEDState(SpecialLEDState::DidConnect);
-            updateFlapPosition();
-            setHDMIEnabled(true); // enable HDMI output after successful connection
-        }
+    global_gpioLamps = new GPIOLampSink(bank);
+    global_outputs.add(global_gpioLamps);
+    if (global_ledLamps) {
+        global_outputs.add(global_ledLamps);
+    }
 
-        if (global_testMode) {
-            time_t nowSeconds = time(nullptr);
-            if (testModeLastTime != nowSeconds) {
-                testModeLastTime = nowSeconds;
-                updateTestMode();
+    defineMIPEncoders(bank);
+    defineOutputs(bank);
+    defineDebounce(bank);
+
+    // until FlightGear tells us the aircraft, the first profile is active
+    loadProfiles(panelLayout());
+    global_profile = global_profiles.front();
+    bank.setWatchedEdges(global_profile->bindings().rising(), global_profile->bindings().falling());
+
+    bank.open();
+
+    global_loop = new EventLoop;
+    for (int bus : bank.buses()) {
+        GPIOScanner* scanner = new GPIOScanner(bank, bus, global_scanRateHz);
+        if (global_idleRateHz > 0) {
+            scanner->setIdlePolicy(global_idleRateHz, global_idleAfter);
+        }
+        for (auto& pin : global_interruptPins) {
+            if (pin.second == bus) {
+                scanner->addInterruptLine(pin.first);
             }
-        } else {
-            time_t nowSeconds = time(nullptr);
-            if ((nowSeconds - lastReadTime) > keepAliveInterval) {
-                // force a write to check for dead socket
-                lastReadTime = nowSeconds;
+        }
+        for (auto& e : global_encoders) {
+            if (e.bus == bus) {
+                scanner->addEncoder(e.encoder);
+            }
+        }
+
+        global_loop->addFd(scanner->wakeFd(), EventLoop::Readable, [scanner](unsigned int) {
+            scanner->dispatchPending(dispatchPanelEvent);
+            checkConnection();
+        });
+        global_scanners.push_back(scanner);
+    }
+
+    global_loop->addTimer(encoderTickInterval, [](uint64_t) {
+        updateEncoders();
+    });
+
+    if (global_ledDriver) {
+        global_loop->addTimer(panelDimmingInterval, [](uint64_t) {
+            updatePanelDimming();
+        });
+    }
+
+    global_loop->addTimer(outputTickInterval, [](uint64_t) {
+        global_outputs.commit();
+    });
+
+    if (global_testMode) {
+        global_loop->addTimer(std::chrono::seconds(1), [](uint64_t) {
+            updateTestMode();
+        });
+    } else {
+        global_loop->addTimer(std::chrono::seconds(keepAliveInterval), [](uint64_t) {
+            // force a write to check for dead socket
+            if (global_fgSocket->isConnected()) {
                 global_fgSocket->write("pwd");
+                checkConnection();
             }
+        });
+
+        connectToFlightGear();
+    }
 
-            bool ok = global_fgSocket->poll(pollHandler, 500 /* msec, so 20hz */);
-            if (!ok) {
-                // poll failed, close out
-                global_fgSocket->close();
-                continue;
+    if (global_printStats) {
+        global_loop->addTimer(std::chrono::seconds(statsInterval), [](uint64_t) {
+            for (GPIOScanner* scanner : global_scanners) {
+                scanner->printStats(std::cerr);
             }
-        }
+            for (auto& e : global_encoders) {
+                std::cerr << "Encoder " << e.property << ": missed transitions "
+                          << e.encoder->missedTransitions() << std::endl;
+            }
+            global_outputs.printStats(std::cerr);
+            if (global_gauges) {
+                global_gauges->printStats(std::cerr);
+            }
+            if (global_steppers) {
+                global_steppers->printStats(std::cerr);
+            }
+            if (global_lampFader) {
+                global_lampFader->printStats(std::cerr);
+            }
+            if (global_ledDriver) {
+                std::cerr << "Panel dimming: " << panelDimmingUpdates << " property updates, "
+                          << panelDimmingWrites << " brightness writes" << std::endl;
+            }
+            for (int bus : global_gpio->buses()) {
+                I2CBus::get(bus).printStats(std::cerr);
+            }
+            for (int bus : global_tracedBuses) {
+                std::cerr << "I2C trace of i2c-" << bus << ":" << std::endl;
+                I2CTracer::summarize(I2CBus::get(bus).tracer()->snapshot(), std::cerr);
+            }
+            for (auto& v : global_virtualBuses) {
+                std::cerr << "Virtual devices on i2c-" << v.first << ":" << std::endl;
+                v.second->dump(std::cerr);
+            }
+        });
+    }
 
-        gearSixpackInputs.update();
-        sixpackAFDSOutputs.update();
-        mipA.update();
-        mipB.update();
-	// check for kill signal
+    for (GPIOScanner* scanner : global_scanners) {
+        scanner->start();
+    }
+    if (global_gauges) {
+        global_gauges->start();
+    }
+    if (global_steppers) {
+        global_steppers->start();
     }
+    global_loop->run();
+    for (GPIOScanner* scanner : global_scanners) {
+        scanner->stop();
+    }
+    if (global_gauges) {
+        global_gauges->stop();
+    }
+    if (global_steppers) {
+        global_steppers->stop();
+    }
+
+    writeTraces();
 
     return EXIT_SUCCESS;
 }